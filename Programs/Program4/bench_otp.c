@@ -0,0 +1,287 @@
+/*********************************************************************
+** Program name:    bench_otp
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**		Usage: bench_otp [-m mode] [-n maxBytes] [-k kernel]
+**		bench_otp measures the throughput of the otp_helpers codec.
+**		Every codec entry point and every kernel this CPU supports
+**		is run over payloads from 1 KB up to maxBytes (1 GB by
+**		default), reporting GB/s, cycles/byte and the number of
+**		allocations each call makes.
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "otp_helpers.h"
+
+#define BENCH_MIN_SIZE 1024
+#define BENCH_MAX_SIZE (1024L * 1024 * 1024)
+#define BENCH_TARGET_BYTES (256L * 1024 * 1024)	// Bytes to process per measurement
+#define BENCH_STREAM_CHUNK (OTP_BUFFERSIZE - 1)	// Chunk size the daemons receive
+
+// Allocation Counting (the linker wraps malloc, calloc and realloc)
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+static unsigned long allocations = 0;
+void* __wrap_malloc(size_t size) { allocations++; return __real_malloc(size); }
+void* __wrap_calloc(size_t count, size_t size) { allocations++; return __real_calloc(count, size); }
+void* __wrap_realloc(void* pointer, size_t size) { allocations++; return __real_realloc(pointer, size); }
+
+// A codec entry point under test. The run function transforms length
+// bytes of input with key into output.
+struct BenchCase {
+	char name[64];
+	int (*run)(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length);
+	OTP_kernelFunc kernel;
+	int mode;
+	int decoding;
+};
+
+// Bench Cases
+int runKernel(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length);
+int runInto(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length);
+int runParallel(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length);
+int runOneTimePad(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length);
+int runStream(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length);
+// Measurement
+unsigned long long readCycles(void);
+void measure(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length);
+
+int main(int argc, char *argv[])
+{
+	int mode = OTP_MODE_ALPHA27;
+	size_t maxSize = BENCH_MAX_SIZE;
+	char* onlyKernel = NULL;
+
+	int option;
+	while ((option = getopt(argc, argv, "m:n:k:")) != -1)
+	{
+		if (option == 'm' && (mode = OTP_parseMode(optarg)) >= 0) {continue;}
+		if (option == 'n' && (maxSize = strtoul(optarg, NULL, 10)) >= BENCH_MIN_SIZE) {continue;}
+		if (option == 'k') {onlyKernel = optarg; continue;}
+		fprintf(stderr, "USAGE: %s [-m alpha27|printable|raw] [-n maxBytes] [-k kernel]\n", argv[0]);
+		exit(1);
+	}
+
+	// Build the list of cases: every supported kernel on its own, then
+	// each codec entry point as the daemons and clients call them
+	struct BenchCase benches[32];
+	int numBenches = 0, count, index, decoding;
+	const struct OTP_Kernel* kernels = OTP_getKernels(&count);
+	for (decoding = 0; decoding <= 1; decoding++)
+	{
+		for (index = 0; index < count; index++)
+		{
+			if (kernels[index].mode != mode || !kernels[index].supported()) {continue;}
+			if (onlyKernel != NULL && strcmp(onlyKernel, kernels[index].name)) {continue;}
+			struct BenchCase* bench = &benches[numBenches++];
+			snprintf(bench->name, sizeof(bench->name), "%s %s", decoding ? "decode" : "encode", kernels[index].name);
+			bench->run = runKernel;
+			bench->kernel = decoding ? kernels[index].decode : kernels[index].encode;
+			bench->mode = mode;
+			bench->decoding = decoding;
+		}
+	}
+	struct { const char* name; int (*run)(struct BenchCase*, const char*, const char*, char*, size_t); } entries[] = {
+		{"OTP_encode", runOneTimePad}, {"OTP_encodeInto", runInto},
+		{"OTP_encodeParallel", runParallel}, {"OTP_streamUpdate", runStream},
+		{"OTP_decode", runOneTimePad}, {"OTP_decodeInto", runInto},
+		{"OTP_decodeParallel", runParallel}, {"OTP_streamUpdate(dec)", runStream}
+	};
+	for (index = 0; index < 8; index++)
+	{
+		// OTP_encode/OTP_decode only handle NUL terminated text
+		if (entries[index].run == runOneTimePad && mode == OTP_MODE_RAW) {continue;}
+		struct BenchCase* bench = &benches[numBenches++];
+		snprintf(bench->name, sizeof(bench->name), "%s", entries[index].name);
+		bench->run = entries[index].run;
+		bench->kernel = NULL;
+		bench->mode = mode;
+		bench->decoding = index >= 4;
+	}
+
+	// Allocate the largest payload once; every size uses a prefix of it
+	char* input = malloc(maxSize + 1);
+	char* key = malloc(maxSize + 1);
+	char* output = malloc(maxSize + 1);
+	if (input == NULL || key == NULL || output == NULL) {fprintf(stderr, "ERROR could not allocate %zu byte payloads\n", maxSize); exit(1);}
+	srand(time(0));
+	OTP_fillPayload(input, maxSize, mode);
+	OTP_fillPayload(key, maxSize, mode);
+
+	printf("Selected kernel: %s (%s)\n", OTP_selectKernel(mode)->name, OTP_modeName(mode));
+	printf("%-24s %12s %10s %12s %12s\n", "codec", "bytes", "GB/s", "cycles/byte", "allocs/call");
+
+	size_t size;
+	for (index = 0; index < numBenches; index++)
+	{
+		for (size = BENCH_MIN_SIZE; size <= maxSize; size *= 4)
+		{
+			measure(&benches[index], input, key, output, size);
+		}
+	}
+
+	free(input);
+	free(key);
+	free(output);
+	return 0;
+}
+
+/*********************************************************************
+ * int runKernel(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+ *  Calls a kernel directly
+ * Returns:
+ * 	0 if every symbol was transformed
+*********************************************************************/
+int runKernel(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+{
+	return bench->kernel(input, key, output, length) != length;
+}
+
+/*********************************************************************
+ * int runInto(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+ *  Calls OTP_encodeInto or OTP_decodeInto
+ * Returns:
+ * 	the codec's result code
+*********************************************************************/
+int runInto(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+{
+	size_t errorOffset;
+	if (bench->decoding) {return OTP_decodeInto(bench->mode, input, length, key, length, output, &errorOffset);}
+	return OTP_encodeInto(bench->mode, input, length, key, length, output, &errorOffset);
+}
+
+/*********************************************************************
+ * int runParallel(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+ *  Calls OTP_encodeParallel or OTP_decodeParallel
+ * Returns:
+ * 	the codec's result code
+*********************************************************************/
+int runParallel(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+{
+	size_t errorOffset;
+	if (bench->decoding) {return OTP_decodeParallel(bench->mode, input, length, key, length, output, &errorOffset);}
+	return OTP_encodeParallel(bench->mode, input, length, key, length, output, &errorOffset);
+}
+
+/*********************************************************************
+ * int runOneTimePad(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+ *  Calls OTP_encode or OTP_decode on NUL terminated copies-in-place
+ *  of the payload, the way the original daemons did
+ * Returns:
+ * 	the codec's result code
+*********************************************************************/
+int runOneTimePad(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+{
+	(void) output; // OneTimePad allocates its own result
+	struct OneTimePad pad;
+	initOTP(&pad);
+	pad.mode = bench->mode;
+
+	// Terminate the payloads where this size ends, then restore them
+	char* text = (char*) input;
+	char* keyText = (char*) key;
+	char savedText = text[length], savedKey = keyText[length];
+	text[length] = keyText[length] = '\0';
+	pad.key = keyText;
+
+	int result;
+	if (bench->decoding)
+	{
+		pad.ciphertext = text;
+		result = OTP_decode(&pad);
+		free(pad.plaintext);
+	}
+	else
+	{
+		pad.plaintext = text;
+		result = OTP_encode(&pad);
+		free(pad.ciphertext);
+	}
+	text[length] = savedText;
+	keyText[length] = savedKey;
+	return result;
+}
+
+/*********************************************************************
+ * int runStream(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+ *  Feeds the stream the whole input, then the key in the chunk size
+ *  the daemons receive
+ * Returns:
+ * 	the codec's result code
+*********************************************************************/
+int runStream(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+{
+	struct OTP_Stream stream;
+	size_t produced, total = 0, offset;
+	OTP_streamInit(&stream, bench->mode, bench->decoding);
+	OTP_streamUpdate(&stream, input, length, NULL, 0, output, &produced);
+	for (offset = 0; offset < length; offset += BENCH_STREAM_CHUNK)
+	{
+		size_t chunk = length - offset < BENCH_STREAM_CHUNK ? length - offset : BENCH_STREAM_CHUNK;
+		OTP_streamUpdate(&stream, NULL, 0, key + offset, chunk, output + total, &produced);
+		total += produced;
+	}
+	return OTP_streamFinish(&stream);
+}
+
+/*********************************************************************
+ * unsigned long long readCycles(void)
+ *  Reads the CPU's time stamp counter, or 0 where there is none
+*********************************************************************/
+unsigned long long readCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/*********************************************************************
+ * void measure(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+ *  Runs a case enough times to cover BENCH_TARGET_BYTES and prints
+ *  one row of results
+ * Arguments:
+ * 	struct BenchCase* bench - the case to run
+ *  const char* input - the payload
+ *  const char* key - the key
+ *  char* output - room for the result
+ *  size_t length - the payload size to measure
+*********************************************************************/
+void measure(struct BenchCase* bench, const char* input, const char* key, char* output, size_t length)
+{
+	long iterations = BENCH_TARGET_BYTES / length, index;
+	if (iterations < 1) {iterations = 1;}
+
+	// One untimed call to warm caches and start any thread pool
+	if (bench->run(bench, input, key, output, length) != 0)
+	{
+		printf("%-24s %12zu   FAILED\n", bench->name, length);
+		return;
+	}
+
+	unsigned long allocationsBefore = allocations;
+	double start = OTP_readSeconds();
+	unsigned long long startCycles = readCycles();
+	for (index = 0; index < iterations; index++)
+	{
+		bench->run(bench, input, key, output, length);
+	}
+	unsigned long long cycles = readCycles() - startCycles;
+	double seconds = OTP_readSeconds() - start;
+
+	double bytes = (double) length * iterations;
+	printf("%-24s %12zu %10.2f %12.3f %12.2f\n", bench->name, length,
+		bytes / seconds / 1e9, cycles / bytes, (double) (allocations - allocationsBefore) / iterations);
+	fflush(stdout);
+}
@@ -4,9 +4,10 @@
  * Date:            11/24/2019
  * Description:     Program 4 for CS344 Operating Systems @ OSU
  *  Program Function:
- *      This program generates a key consisting of 27 possible characters.
+ *      This program generates a key consisting of 27 possible characters,
+ *      or of any printable character or any byte with -m printable/raw.
  *  Arguments:
- *      The length of the key
+ *      [-m alpha27|printable|raw] The length of the key
  *  Returns:
  *      Prints the key.
 ****************************************************************/
@@ -14,17 +15,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include "keygen.h"
+#include "otp_helpers.h"
 
 int main(int argc, char* argv[])
 {
     int keyLength;  // The Length of the Key File
+    int mode = OTP_MODE_ALPHA27; // The Alphabet of the Key
     srand(time(0)); // Seed Randomizer
 
-    checkArgCount(argc); // Check for Valid Number of Arguments
-    keyLength = getKeyLength(argv[1]); // Save the Key Length
+    // Get the Alphabet Mode, if One was Given
+    int option;
+    while ((option = getopt(argc, argv, "m:")) != -1)
+    {
+        if (option == 'm' && (mode = OTP_parseMode(optarg)) >= 0) {continue;}
+        fprintf(stderr, "Usage: keygen [-m alpha27|printable|raw] [keyLength]\n");
+        exit(1);
+    }
 
-    printKey(keyLength); // Output the Randomly Generated Key
+    checkArgCount(argc - optind + 1); // Check for Valid Number of Arguments
+    keyLength = getKeyLength(argv[optind]); // Save the Key Length
+
+    printKey(keyLength, mode); // Output the Randomly Generated Key
 
     return 0;
 }
@@ -41,7 +54,7 @@ void checkArgCount(int numArgs)
     // If no arguments, print how to use the program
     if (numArgs < 2)
     {
-        fprintf(stderr, "Usage: keygen [keyLength]\n");
+        fprintf(stderr, "Usage: keygen [-m alpha27|printable|raw] [keyLength]\n");
         exit(1);
     }
     // If more than 2 arguments, inform that there are too many arguments
@@ -91,16 +104,28 @@ int _pickRandInt(int min, int max)
 }
 
 /****************************************************************
- * char pickRandChar()
+ * char pickRandChar(int mode)
  *  Randomly picks from the choice of a letter from A-Z or a
- *  space character
+ *  space character, or from the alphabet of another mode
+ * Arguments:
+ *  int mode = the OTP_MODE alphabet to pick from
  * Returns:
  *  char = Randomly determined A-Z, or space
 ****************************************************************/
-char pickRandChar()
+char pickRandChar(int mode)
 {
     char randChar = ' '; // Set a random character to a 
 
+    // Other alphabets are contiguous ranges of characters
+    if (mode == OTP_MODE_PRINTABLE)
+    {
+        return (char) (' ' + _pickRandInt(0, OTP_PRINTABLE_CHARS - 1));
+    }
+    else if (mode == OTP_MODE_RAW)
+    {
+        return (char) _pickRandInt(0, 255);
+    }
+
     // Pick a random integer between 0 and 26
     int value = _pickRandInt(0, 26);
 
@@ -113,19 +138,23 @@ char pickRandChar()
 }
 
 /****************************************************************
- * void printKey(int numChar)
+ * void printKey(int numChar, int mode)
  *  Prints the randomly generated key into stdout.
  * Arguments:
  *  int numChar = the length of the key to generate
+ *  int mode = the OTP_MODE alphabet of the key
 ****************************************************************/
-void printKey(int numChar)
+void printKey(int numChar, int mode)
 {
     // Print a random character numChar times.
     int count;
     for (count = 0; count < numChar; count++)
     {
-        printf("%c", pickRandChar());
+        putchar(pickRandChar(mode));
+    }
+    // Print Newline, unless every byte of a raw key is key material
+    if (mode != OTP_MODE_RAW)
+    {
+        printf("\n");
     }
-    // Print Newline
-    printf("\n");
 }
\ No newline at end of file
@@ -16,7 +16,7 @@
 void checkArgCount(int numArgs);
 int getKeyLength(char* input);
 int _pickRandInt(int min, int max);
-char pickRandChar();
-void printKey(int numChar);
+char pickRandChar(int mode);
+void printKey(int numChar, int mode);
 
 #endif
\ No newline at end of file
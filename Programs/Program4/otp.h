@@ -0,0 +1,93 @@
+/*********************************************************************
+** Program name:    OTP
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**      This is libotp's public API: the one-time pad codec of otp_enc,
+**      otp_dec and otp_d, for programs that encode and decode
+**      in-process. It covers the alphabets, validation, whole-buffer
+**      and parallel encoding and decoding, the streaming codec the
+**      daemons run, and running it over whole files. Within an
+**      OTP_API_VERSION, these declarations and the meaning of every
+**      constant here only gain additions; a change to any of them
+**      comes with a new version. This is the header file.
+*********************************************************************/
+#ifndef OTP_H
+#define OTP_H
+
+#include <stddef.h>
+
+#define OTP_API_VERSION 1
+
+// Marks what libotp.so exports. The library is built with hidden
+// visibility, so nothing else in it can clash with a program's symbols.
+#define OTP_API __attribute__((visibility("default")))
+
+// Alphabet Modes
+#define OTP_MODE_ALPHA27 0		// 'A'-'Z' and ' ', added modulo 27
+#define OTP_MODE_PRINTABLE 1	// ' ' through '~', added modulo 95
+#define OTP_MODE_RAW 2			// Any byte, XORed with the key
+#define OTP_NUM_MODES 3
+
+// Codec Result Codes
+#define OTP_SUCCESS 0
+#define OTP_ERR_BADTEXT -1	// Input holds a character outside the alphabet
+#define OTP_ERR_BADKEY -2	// Key holds a character outside the alphabet
+#define OTP_ERR_KEYSHORT -3	// Key is shorter than the input
+#define OTP_ERR_FILE -4		// File could not be opened or read
+#define OTP_ERR_NOKEY -5	// No stored key has the ID, or the daemon has no key store
+#define OTP_ERR_KEYUSED -6	// Stored key range was already used to encode
+
+// Growable byte buffer. Appends double the capacity when it runs out,
+// so accumulating N bytes costs O(N) copying. The bytes are always
+// followed by a NUL so text payloads can be used as strings.
+struct OTP_Buffer {
+	char* data;
+	size_t length;
+	size_t capacity;
+};
+
+// Incremental codec state. Input and key may arrive in any chunk sizes;
+// bytes of the side that is ahead wait in pending, from pendingStart
+// on, for the other side.
+struct OTP_Stream {
+	int mode;
+	int decoding;
+	size_t offset;		// Number of symbols transformed so far
+	int finished;		// Set once the input's trailing newline is seen
+	int result;			// OTP_SUCCESS, or the OTP_ERR code that stopped the stream
+	struct OTP_Buffer pending;
+	size_t pendingStart;
+	int pendingIsKey;
+};
+
+// Library Version
+OTP_API int OTP_apiVersion(void);
+// Buffer Functions
+OTP_API int OTP_bufferInit(struct OTP_Buffer* buffer, size_t sizeHint);
+OTP_API char* OTP_bufferReserve(struct OTP_Buffer* buffer, size_t extra);
+OTP_API int OTP_bufferAppend(struct OTP_Buffer* buffer, const char* data, size_t length);
+OTP_API int OTP_bufferFree(struct OTP_Buffer* buffer);
+// Alphabet Functions
+OTP_API int OTP_parseMode(const char* name);
+OTP_API const char* OTP_modeName(int mode);
+OTP_API int OTP_symbolValue(int mode, int character);
+// Validation Functions
+OTP_API size_t OTP_validateBuffer(int mode, const char* data, size_t length);
+OTP_API int OTP_validateFd(int fileDescriptor, int mode, size_t* length, size_t* badOffset);
+OTP_API int OTP_validateFile(const char* fileName, int mode, size_t* length, size_t* badOffset);
+// Encoding/Decoding Functions
+OTP_API int OTP_encodeInto(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset);
+OTP_API int OTP_decodeInto(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset);
+OTP_API int OTP_encodeParallel(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset);
+OTP_API int OTP_decodeParallel(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset);
+OTP_API const char* OTP_errorString(int code);
+// Streaming Encoding/Decoding Functions
+OTP_API int OTP_streamInit(struct OTP_Stream* stream, int mode, int decoding);
+OTP_API size_t OTP_streamBound(const struct OTP_Stream* stream, size_t inputLength);
+OTP_API int OTP_streamUpdate(struct OTP_Stream* stream, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* outputLength);
+OTP_API int OTP_streamFinish(struct OTP_Stream* stream);
+OTP_API int OTP_streamFiles(int mode, int decoding, int inputFD, size_t inputLength, int keyFD, size_t keyLength, struct OTP_Buffer* output, size_t* errorOffset);
+
+#endif
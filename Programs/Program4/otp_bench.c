@@ -0,0 +1,534 @@
+/*********************************************************************
+** Program name:    otp_bench
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**		Usage: otp_bench [-m mode] [-d] [-c connections] [-n requests | -t seconds]
+**			[-r rate] [-s sizes] port|path
+**		       otp_bench [options] -x models [-b daemon]
+**		otp_bench measures a daemon end to end: it opens connections
+**		to it, keeps them busy with requests of random symbols, and
+**		reports requests/s, MB/s of text and the p50/p99/p999 latency
+**		from a request's first frame to the end of its reply.
+**		By default the load is a closed loop: each connection sends
+**		its next request once the last is answered. Given -r rate it
+**		is an open loop instead: requests go out on a fixed schedule
+**		that many times a second in all, whether or not the daemon
+**		keeps up, and each latency counts from when the request was
+**		due, so a stalled daemon can't hide its queueing delay.
+**		Sizes are a comma separated list of choices, each a size or a
+**		range "low-high" with an optional ":weight", or "exp:mean" for
+**		exponentially distributed sizes; K and M suffixes are allowed.
+**		With -x it starts the daemon itself once for each listed
+**		serving model - fork, reactor, uring, prefork and threads,
+**		each with an optional ":count" for its limit, workers or
+**		threads - runs the same load against each, and prints one
+**		row per model to compare.
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "otp_helpers.h"
+#include "otp_stats.h"
+
+#define BENCH_MAX_CONNECTIONS 1024
+#define BENCH_MAX_CHOICES 16
+#define BENCH_WINDOW 4096			// Most requests one connection has outstanding in an open loop
+#define BENCH_DEFAULT_REQUESTS 1000
+#define BENCH_DEFAULT_SIZE 1024
+#define BENCH_DAEMON_WAIT 5			// Seconds to wait for a started daemon to listen
+
+// One way of picking a request size
+struct SizeChoice {
+	size_t low;
+	size_t high;		// Same as low for a fixed size
+	double weight;
+	int exponential;	// Set for "exp:mean", with the mean in low
+};
+
+// The load to put on a daemon, the same for every model compared
+struct BenchLoad {
+	char* destination;
+	int mode;
+	int decoding;
+	int connections;
+	long requests;		// In all, or 0 to run for seconds instead
+	double seconds;
+	double rate;		// Requests per second in all, or 0 for a closed loop
+	struct SizeChoice choices[BENCH_MAX_CHOICES];
+	int numChoices;
+	double totalWeight;
+	size_t maxSize;
+	char* text;			// Random symbols every request sends a prefix of
+	char* key;
+};
+
+// One connection's sender and receiver threads, and what they share
+struct BenchConnection {
+	struct BenchLoad* load;
+	struct OTP_Stats* stats;
+	int socketFD;		// -1 if the daemon refused it
+	size_t chunkSize;
+	long requests;		// This connection's share, or 0 until the deadline
+	double interval;	// Seconds between its requests in an open loop
+	double firstDue;
+	double deadline;
+	unsigned int seed;
+	sem_t room;			// Free slots in the window of outstanding requests
+	uint64_t starts[BENCH_WINDOW];	// When each outstanding request was due, by ID
+	size_t sizes[BENCH_WINDOW];
+};
+
+// Load Set Up
+int parseSizes(char* spec, struct BenchLoad* load);
+size_t parseSize(const char* text);
+size_t pickSize(struct BenchLoad* load, unsigned int* seed);
+// Running the Load
+int runLoad(struct BenchLoad* load, const char* label);
+void* runConnection(void* arguments);
+void sendRequests(struct BenchConnection* connection);
+void* receiveReplies(void* arguments);
+// Comparing Serving Models
+pid_t startDaemon(const char* daemon, char* model, const char* path);
+void stopDaemon(pid_t daemonPID, const char* path);
+
+int main(int argc, char *argv[])
+{
+	struct BenchLoad load;
+	memset(&load, 0, sizeof(load));
+	load.mode = OTP_MODE_ALPHA27;
+	load.connections = 1;
+	char* sizes = NULL, * models = NULL, * daemon = NULL;
+
+	int option;
+	while ((option = getopt(argc, argv, "m:dc:n:t:r:s:x:b:")) != -1)
+	{
+		if (option == 'm' && (load.mode = OTP_parseMode(optarg)) >= 0) {continue;}
+		if (option == 'd') {load.decoding = 1; continue;}
+		if (option == 'c' && (load.connections = atoi(optarg)) > 0 && load.connections <= BENCH_MAX_CONNECTIONS) {continue;}
+		if (option == 'n' && (load.requests = atol(optarg)) > 0) {continue;}
+		if (option == 't' && (load.seconds = atof(optarg)) > 0) {continue;}
+		if (option == 'r' && (load.rate = atof(optarg)) > 0) {continue;}
+		if (option == 's') {sizes = optarg; continue;}
+		if (option == 'x') {models = optarg; continue;}
+		if (option == 'b') {daemon = optarg; continue;}
+		fprintf(stderr, "USAGE: %s [-m alpha27|printable|raw] [-d] [-c connections] [-n requests | -t seconds] [-r rate] [-s sizes] port|path | -x models [-b daemon]\n", argv[0]);
+		exit(1);
+	}
+	if ((models == NULL) != (argc - optind == 1) || (load.requests > 0 && load.seconds > 0))
+	{
+		fprintf(stderr, "USAGE: %s [-m alpha27|printable|raw] [-d] [-c connections] [-n requests | -t seconds] [-r rate] [-s sizes] port|path | -x models [-b daemon]\n", argv[0]);
+		exit(1);
+	}
+	if (load.requests == 0 && load.seconds == 0) {load.requests = BENCH_DEFAULT_REQUESTS;}
+	if (load.requests > 0 && load.requests < load.connections) {load.connections = load.requests;}
+	char defaultSizes[32];
+	snprintf(defaultSizes, sizeof(defaultSizes), "%d", BENCH_DEFAULT_SIZE);
+	if (parseSizes(sizes != NULL ? sizes : defaultSizes, &load) < 0) {fprintf(stderr, "ERROR '%s' is not a size distribution\n", sizes); exit(1);}
+
+	// Every request sends a prefix of the same random text and key
+	load.text = malloc(load.maxSize + 1);
+	load.key = malloc(load.maxSize + 1);
+	if (load.text == NULL || load.key == NULL) {fprintf(stderr, "ERROR could not allocate %zu byte payloads\n", load.maxSize); exit(1);}
+	srand(getpid());
+	OTP_fillPayload(load.text, load.maxSize, load.mode);
+	OTP_fillPayload(load.key, load.maxSize, load.mode);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%s %s, %d connections, %s", load.decoding ? "decode" : "encode", OTP_modeName(load.mode), load.connections, load.rate > 0 ? "open loop" : "closed loop");
+	if (load.rate > 0) {printf(" at %.0f/s", load.rate);}
+	printf(", sizes %s\n", sizes != NULL ? sizes : defaultSizes);
+	printf("%-16s %10s %8s %10s %10s %10s %10s %10s %10s\n", "model", "requests", "errors", "req/s", "MB/s", "p50 us", "p99 us", "p999 us", "max us");
+
+	int exitStatus = 0;
+	if (models == NULL)
+	{
+		load.destination = argv[optind];
+		exitStatus = runLoad(&load, "daemon");
+	}
+	else
+	{
+		// The daemon sits next to this program unless told otherwise
+		char daemonPath[4096];
+		if (daemon == NULL)
+		{
+			char* slash = strrchr(argv[0], '/');
+			snprintf(daemonPath, sizeof(daemonPath), "%.*sotp_d", slash != NULL ? (int) (slash - argv[0] + 1) : 0, argv[0]);
+			daemon = slash != NULL ? daemonPath : "./otp_d";
+		}
+
+		// Each model gets a fresh daemon on its own Unix socket, so one
+		// still shutting down can't be measured in place of the next
+		char* model = strtok(models, ",");
+		int index;
+		for (index = 0; model != NULL; index++, model = strtok(NULL, ","))
+		{
+			char path[108];
+			snprintf(path, sizeof(path), "/tmp/otp_bench.%d.%d.sock", (int) getpid(), index);
+			pid_t daemonPID = startDaemon(daemon, model, path);
+			if (daemonPID < 0) {exitStatus = 1; continue;}
+			load.destination = path;
+			exitStatus |= runLoad(&load, model);
+			stopDaemon(daemonPID, path);
+		}
+	}
+
+	free(load.text);
+	free(load.key);
+	return exitStatus;
+}
+
+/*********************************************************************
+ * size_t parseSize(const char* text)
+ *  Reads a byte count, with an optional K or M suffix
+ * Returns:
+ * 	size_t - the count, 0 if text isn't one
+*********************************************************************/
+size_t parseSize(const char* text)
+{
+	char* end;
+	size_t size = strtoul(text, &end, 10);
+	if (*end == 'K' || *end == 'k') {size *= 1024; end++;}
+	else if (*end == 'M' || *end == 'm') {size *= 1024 * 1024; end++;}
+
+	return end == text || *end != '\0' ? 0 : size;
+}
+
+/*********************************************************************
+ * int parseSizes(char* spec, struct BenchLoad* load)
+ *  Reads the size distribution into the load's choices
+ * Arguments:
+ * 	char* spec - the distribution, as described in the usage
+ *  struct BenchLoad* load - where the choices and largest size go
+ * Returns:
+ * 	0 on success, -1 if spec isn't a distribution
+*********************************************************************/
+int parseSizes(char* spec, struct BenchLoad* load)
+{
+	char copy[1024];
+	snprintf(copy, sizeof(copy), "%s", spec);
+	char* choice = strtok(copy, ",");
+
+	for (load->numChoices = 0; choice != NULL; choice = strtok(NULL, ","))
+	{
+		if (load->numChoices == BENCH_MAX_CHOICES) {return -1;}
+		struct SizeChoice* size = &load->choices[load->numChoices++];
+		size->weight = 1;
+		size->exponential = strncmp(choice, "exp:", 4) == 0;
+		if (size->exponential) {choice += 4;}
+
+		char* weight = strchr(choice, ':');
+		if (weight != NULL)
+		{
+			*weight++ = '\0';
+			if ((size->weight = atof(weight)) <= 0) {return -1;}
+		}
+		char* dash = strchr(choice, '-');
+		if (dash != NULL && !size->exponential) {*dash++ = '\0';}
+		size->low = parseSize(choice);
+		size->high = dash != NULL && !size->exponential ? parseSize(dash) : size->low;
+		if (size->low == 0 || size->high < size->low) {return -1;}
+
+		// Exponential sizes are cut off at ten times their mean
+		size_t largest = size->exponential ? 10 * size->low : size->high;
+		if (largest > load->maxSize) {load->maxSize = largest;}
+		load->totalWeight += size->weight;
+	}
+	return load->numChoices > 0 ? 0 : -1;
+}
+
+/*********************************************************************
+ * size_t pickSize(struct BenchLoad* load, unsigned int* seed)
+ *  Draws the size of the next request from the distribution
+ * Arguments:
+ * 	struct BenchLoad* load - the load and its choices
+ *  unsigned int* seed - the calling thread's random state
+ * Returns:
+ * 	size_t - the size, from 1 to the load's largest
+*********************************************************************/
+size_t pickSize(struct BenchLoad* load, unsigned int* seed)
+{
+	double pick = rand_r(seed) / ((double) RAND_MAX + 1) * load->totalWeight;
+	int index;
+	for (index = 0; index < load->numChoices - 1 && pick >= load->choices[index].weight; index++)
+	{
+		pick -= load->choices[index].weight;
+	}
+
+	struct SizeChoice* choice = &load->choices[index];
+	double uniform = rand_r(seed) / ((double) RAND_MAX + 1);
+	if (choice->exponential)
+	{
+		size_t size = (size_t) (-log(1 - uniform) * choice->low) + 1;
+		return size < load->maxSize ? size : load->maxSize;
+	}
+	return choice->low + (size_t) (uniform * (choice->high - choice->low + 1));
+}
+
+/*********************************************************************
+ * int runLoad(struct BenchLoad* load, const char* label)
+ *  Opens the connections, runs the load over them to the end, and
+ *  prints a row of results
+ * Arguments:
+ * 	struct BenchLoad* load - the load and the daemon to put it on
+ *  const char* label - what to call the row
+ * Returns:
+ * 	int - 0, or 1 if any request failed or a connection was refused
+*********************************************************************/
+int runLoad(struct BenchLoad* load, const char* label)
+{
+	struct OTP_Stats* stats = OTP_statsCreate();
+	struct BenchConnection* connections = calloc(load->connections, sizeof(struct BenchConnection));
+	pthread_t* threads = calloc(load->connections, sizeof(pthread_t));
+	if (stats == NULL || connections == NULL || threads == NULL) {fprintf(stderr, "ERROR could not allocate %d connections\n", load->connections); exit(1);}
+
+	// Each connection says hello on its own thread, so one the daemon
+	// makes wait for a slot doesn't hold up the rest
+	double start = OTP_readSeconds();
+	int index, refused = 0;
+	for (index = 0; index < load->connections; index++)
+	{
+		struct BenchConnection* connection = &connections[index];
+		connection->load = load;
+		connection->stats = stats;
+		connection->seed = getpid() * BENCH_MAX_CONNECTIONS + index;
+		connection->requests = load->requests / load->connections + (index < load->requests % load->connections);
+		connection->deadline = load->seconds > 0 ? start + load->seconds : 0;
+		if (load->rate > 0)
+		{
+			// Each connection takes its share of the rate, staggered so
+			// the requests are evenly spread in time
+			connection->interval = load->connections / load->rate;
+			connection->firstDue = start + connection->interval * index / load->connections;
+		}
+		sem_init(&connection->room, 0, load->rate > 0 ? BENCH_WINDOW : 1);
+		if (pthread_create(&threads[index], NULL, runConnection, connection) != 0) {fprintf(stderr, "ERROR starting thread\n"); exit(1);}
+	}
+	for (index = 0; index < load->connections; index++)
+	{
+		pthread_join(threads[index], NULL);
+		refused += connections[index].socketFD < 0;
+	}
+	double elapsed = OTP_readSeconds() - start;
+	if (refused > 0) {fprintf(stderr, "Error: the daemon %s %s refused %d connections\n", OTP_isSocketPath(load->destination) ? "at" : "on port", load->destination, refused);}
+
+	const struct OTP_Histogram* latency = &stats->histograms[OTP_STAT_TOTAL];
+	uint64_t errors = stats->counters[OTP_STAT_ERRORS] + stats->counters[OTP_STAT_FAILED];
+	printf("%-16s %10llu %8llu %10.0f %10.2f %10.1f %10.1f %10.1f %10.1f\n", label,
+		(unsigned long long) stats->counters[OTP_STAT_REQUESTS], (unsigned long long) errors,
+		stats->counters[OTP_STAT_REQUESTS] / elapsed, stats->counters[OTP_STAT_BYTES_OUT] / elapsed / 1e6,
+		OTP_histogramPercentile(latency, 50) / 1e3, OTP_histogramPercentile(latency, 99) / 1e3,
+		OTP_histogramPercentile(latency, 99.9) / 1e3, latency->max / 1e3);
+	fflush(stdout);
+
+	for (index = 0; index < load->connections; index++) {sem_destroy(&connections[index].room);}
+	free(connections);
+	free(threads);
+	munmap(stats, sizeof(struct OTP_Stats));
+	return refused > 0 || errors > 0;
+}
+
+/*********************************************************************
+ * void* runConnection(void* arguments)
+ *  Opens a connection, then sends its requests while a second thread
+ *  reads the replies, until both are done
+ * Arguments:
+ * 	void* arguments - the struct BenchConnection
+*********************************************************************/
+void* runConnection(void* arguments)
+{
+	struct BenchConnection* connection = arguments;
+	struct BenchLoad* load = connection->load;
+	connection->chunkSize = OTP_CHUNK_DEFAULT;
+	connection->socketFD = OTP_clientOpen(load->destination, load->decoding, load->mode, &connection->chunkSize);
+	if (connection->socketFD < 0) {return NULL;}
+
+	pthread_t receiver;
+	if (pthread_create(&receiver, NULL, receiveReplies, connection) != 0) {fprintf(stderr, "ERROR starting thread\n"); exit(1);}
+	sendRequests(connection);
+	pthread_join(receiver, NULL);
+	close(connection->socketFD);
+	return NULL;
+}
+
+/*********************************************************************
+ * static int _sendStream(int socketFD, int opcode, const char* data, size_t length, size_t chunkSize, unsigned long requestID)
+ *  Sends one request's text or key as frames of the agreed chunk size
+*********************************************************************/
+static int _sendStream(int socketFD, int opcode, const char* data, size_t length, size_t chunkSize, unsigned long requestID)
+{
+	size_t offset;
+	for (offset = 0; offset < length; offset += chunkSize)
+	{
+		size_t chunk = length - offset < chunkSize ? length - offset : chunkSize;
+		int flags = offset + chunk == length ? OTP_FLAG_END : 0;
+		if (OTP_sendFrame(socketFD, opcode, flags, data + offset, chunk, requestID) < 0) {return -1;}
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * void sendRequests(struct BenchConnection* connection)
+ *  Sends a connection's requests, each once there is room in its
+ *  window and, in an open loop, once it is due. Shuts the sending
+ *  side down after the last, so the daemon closes the connection once
+ *  it has answered everything.
+ * Arguments:
+ * 	struct BenchConnection* connection - the connection
+*********************************************************************/
+void sendRequests(struct BenchConnection* connection)
+{
+	struct BenchLoad* load = connection->load;
+	unsigned long requestID;
+
+	for (requestID = 1; connection->requests == 0 || requestID <= (unsigned long) connection->requests; requestID++)
+	{
+		double due = connection->firstDue + (requestID - 1) * connection->interval;
+		while (sem_wait(&connection->room) < 0);
+		double now = OTP_readSeconds();
+		if (connection->deadline > 0 && (load->rate > 0 ? due : now) >= connection->deadline) {sem_post(&connection->room); break;}
+
+		// An open loop sends on schedule and times from when it was due;
+		// a closed loop sends as soon as the last request is answered
+		if (load->rate > 0 && due > now) {usleep((due - now) * 1e6);}
+		connection->starts[requestID % BENCH_WINDOW] = load->rate > 0 ? (uint64_t) (due * 1e9) : OTP_statsNow();
+
+		size_t size = pickSize(load, &connection->seed);
+		connection->sizes[requestID % BENCH_WINDOW] = size;
+		if (_sendStream(connection->socketFD, OTP_OP_TEXT, load->text, size, connection->chunkSize, requestID) < 0) {break;}
+		if (_sendStream(connection->socketFD, OTP_OP_KEY, load->key, size, connection->chunkSize, requestID) < 0) {break;}
+	}
+	shutdown(connection->socketFD, SHUT_WR);
+}
+
+/*********************************************************************
+ * void* receiveReplies(void* arguments)
+ *  Reads a connection's replies until the daemon closes it, timing
+ *  each request as its reply ends
+ * Arguments:
+ * 	void* arguments - the struct BenchConnection
+*********************************************************************/
+void* receiveReplies(void* arguments)
+{
+	struct BenchConnection* connection = arguments;
+	struct OTP_Frame frame;
+	char* payload = malloc(connection->chunkSize);
+
+	while (OTP_recvFrame(connection->socketFD, &frame, payload, connection->chunkSize) == 0)
+	{
+		// A request is answered by its last DATA frame, or by an ERROR
+		int failed = frame.opcode == OTP_OP_ERROR;
+		if (!failed && (frame.opcode != OTP_OP_DATA || !(frame.flags & OTP_FLAG_END))) {continue;}
+
+		uint64_t now = OTP_statsNow(), start = connection->starts[frame.requestID % BENCH_WINDOW];
+		OTP_statsRecord(connection->stats, OTP_STAT_TOTAL, now > start ? now - start : 0);
+		OTP_statsCount(connection->stats, OTP_STAT_REQUESTS, 1);
+		OTP_statsCount(connection->stats, failed ? OTP_STAT_ERRORS : OTP_STAT_BYTES_OUT, failed ? 1 : connection->sizes[frame.requestID % BENCH_WINDOW]);
+		sem_post(&connection->room);
+	}
+	// Replies cut short by a dropped connection are failures too
+	int outstanding;
+	sem_getvalue(&connection->room, &outstanding);
+	outstanding = (connection->load->rate > 0 ? BENCH_WINDOW : 1) - outstanding;
+	if (outstanding > 0) {OTP_statsCount(connection->stats, OTP_STAT_FAILED, outstanding);}
+
+	// Let the sender out of its wait if it is still in one
+	sem_post(&connection->room);
+	free(payload);
+	return NULL;
+}
+
+/*********************************************************************
+ * pid_t startDaemon(const char* daemon, char* model, const char* path)
+ *  Starts the daemon with a serving model, listening only on a Unix
+ *  socket, and waits for it to be ready
+ * Arguments:
+ * 	const char* daemon - the otp_d program
+ *  char* model - "fork", "reactor", "uring", "prefork" or "threads",
+ *  	with an optional ":count"
+ *  const char* path - the socket path to listen on
+ * Returns:
+ * 	pid_t - the daemon, or -1 if it couldn't be started
+*********************************************************************/
+pid_t startDaemon(const char* daemon, char* model, const char* path)
+{
+	char* arguments[8] = {(char*) daemon};
+	int count = 1;
+	char* number = strchr(model, ':');
+	char name[32];
+	snprintf(name, sizeof(name), "%.*s", number != NULL ? (int) (number - model) : (int) strlen(model), model);
+	if (number != NULL) {number++;}
+
+	if (strcmp(name, "reactor") == 0 || strcmp(name, "uring") == 0)
+	{
+		arguments[count++] = strcmp(name, "reactor") == 0 ? "--reactor" : "--uring";
+		if (number != NULL) {arguments[count++] = "--limit"; arguments[count++] = number;}
+	}
+	else if (strcmp(name, "prefork") == 0 || strcmp(name, "threads") == 0)
+	{
+		arguments[count++] = strcmp(name, "prefork") == 0 ? "--prefork" : "--threads";
+		arguments[count++] = number != NULL ? number : strcmp(name, "prefork") == 0 ? "4" : "0";
+	}
+	else if (strcmp(name, "fork") == 0)
+	{
+		if (number != NULL) {arguments[count++] = "--limit"; arguments[count++] = number;}
+	}
+	else
+	{
+		fprintf(stderr, "ERROR '%s' is not a serving model\n", model);
+		return -1;
+	}
+	arguments[count++] = "--unix";
+	arguments[count++] = (char*) path;
+	arguments[count] = NULL;
+
+	unlink(path);
+	pid_t daemonPID = fork();
+	if (daemonPID < 0) {perror("fork"); return -1;}
+	if (daemonPID == 0)
+	{
+		execv(daemon, arguments);
+		perror(daemon);
+		_exit(1);
+	}
+
+	// Ready once the socket is there; give it a moment more to listen
+	double deadline = OTP_readSeconds() + BENCH_DAEMON_WAIT;
+	struct stat status;
+	while (stat(path, &status) < 0)
+	{
+		if (waitpid(daemonPID, NULL, WNOHANG) == daemonPID || OTP_readSeconds() > deadline)
+		{
+			fprintf(stderr, "ERROR the %s daemon did not start\n", model);
+			stopDaemon(daemonPID, path);
+			return -1;
+		}
+		usleep(10000);
+	}
+	usleep(50000);
+	return daemonPID;
+}
+
+/*********************************************************************
+ * void stopDaemon(pid_t daemonPID, const char* path)
+ *  Stops a daemon startDaemon started, along with any children, and
+ *  removes its socket
+*********************************************************************/
+void stopDaemon(pid_t daemonPID, const char* path)
+{
+	kill(daemonPID, SIGTERM);
+	waitpid(daemonPID, NULL, 0);
+	unlink(path);
+}
@@ -0,0 +1,252 @@
+/*********************************************************************
+** Program name:    OTP
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**		Usage: otp_d [--reactor | --uring | --prefork workers | --threads count]
+**			[--unix path] [--keys directory] [--limit count] [--queue count]
+**			[port]
+**		otp_d works with otp_enc and otp_dec to encode plaintext into
+**		ciphertext, or decode ciphertext into plaintext, using a
+**		provided key. This program serves as the server. This program
+**		takes the text and the key from the client, encodes or decodes
+**		the text as the client's hello asks, and sends the result back
+**		to the client.
+**		With --unix it also listens on a Unix domain socket at path, or
+**		only there if no port is given, for clients on the same host.
+**		With --keys it keeps a key store in directory: clients upload
+**		a key once, then name it by ID in place of sending it, and the
+**		store makes sure no range of it is used to encode twice.
+**		Every serving model keeps counters and latency histograms in
+**		shared memory, which "otp_enc -s port" reads with a STATS frame.
+**		With --limit it serves at most count connections at once (per
+**		worker in prefork mode; the thread count in threads mode), and
+**		with --queue lets up to count more wait for a slot when forking
+**		or threaded. Past that a connection is answered busy with a
+**		hint of how long to wait, and clients back off and retry.
+**		Built with OTP_DAEMON_SERVES set to OTP_SERVE_ENCODE or
+**		OTP_SERVE_DECODE, this is otp_enc_d or otp_dec_d, which serve
+**		only otp_enc or only otp_dec as before.
+**		Code adapted from server.c from Program 4 Lecture
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h> 
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "otp_helpers.h"
+#include "otp_server.h"
+#include "otp_keys.h"
+
+// Connections waiting for a child, oldest first, in a ring of size
+struct WaitQueue {
+	int* fds;
+	int head;
+	int count;
+	int size;
+};
+
+pid_t spawnChild(int connectionFD, const int listenFDs[], int listeners, const struct WaitQueue* waiting, int childFD, const struct OTP_Service* service);
+
+// Operations this build serves: both, or one for otp_enc_d and otp_dec_d
+#ifndef OTP_DAEMON_SERVES
+#define OTP_DAEMON_SERVES OTP_SERVE_BOTH
+#endif
+
+int main(int argc, char *argv[])
+{
+	struct OTP_Service service = {OTP_DAEMON_SERVES, NULL, OTP_statsCreate(), 0, -1};
+	struct OTP_KeyStore keys;
+
+	int listenSocketFD, establishedConnectionFD, portNumber;
+	struct sockaddr_in serverAddress;
+	int listenFDs[2], listeners = 0; // The Unix socket and TCP port, as asked for
+
+	int index;
+
+	// Get the serving model, if one was given
+	int reactor = 0, uring = 0, workers = 0, threads = -1, option;
+	char* unixPath = NULL, * keyPath = NULL;
+	struct option options[] = {{"reactor", no_argument, &reactor, 1}, {"uring", no_argument, &uring, 1}, {"prefork", required_argument, NULL, 'p'}, {"threads", required_argument, NULL, 't'}, {"unix", required_argument, NULL, 'u'}, {"keys", required_argument, NULL, 'k'}, {"limit", required_argument, NULL, 'l'}, {"queue", required_argument, NULL, 'q'}, {0, 0, 0, 0}};
+	while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		if (option == 0) {continue;}
+		if (option == 'p' && (workers = atoi(optarg)) > 0 && workers <= OTP_PREFORK_MAX) {continue;}
+		if (option == 't' && (threads = atoi(optarg)) >= 0 && threads <= OTP_THREADS_MAX) {continue;} // 0 means one per core
+		if (option == 'u') {unixPath = optarg; continue;}
+		if (option == 'k') {keyPath = optarg; continue;}
+		if (option == 'l' && (service.limit = atoi(optarg)) > 0) {continue;}
+		if (option == 'q' && (service.queue = atoi(optarg)) >= 0) {continue;}
+		fprintf(stderr,"USAGE: %s [--reactor | --uring | --prefork workers | --threads count] [--unix path] [--keys directory] [--limit count] [--queue count] port\n", argv[0]); exit(1);
+	}
+	if (argc - optind < 1 && unixPath == NULL) { fprintf(stderr,"USAGE: %s [--reactor | --uring | --prefork workers | --threads count] [--unix path] [--keys directory] [--limit count] [--queue count] port\n", argv[0]); exit(1); } // Check usage & args
+	int tcp = argc - optind >= 1;
+	argv += optind - 1; // Skip past the options so the port is argv[1]
+	int backlog = SOMAXCONN; // Connections are admitted or refused here, not left waiting in the kernel
+
+	// Every process serving the store maps the same key files, so the
+	// workers and children forked below share it
+	if (keyPath != NULL)
+	{
+		if (OTP_keyStoreOpen(&keys, keyPath) < 0) OTP_fatal("ERROR opening key store");
+		service.keys = &keys;
+	}
+
+	// Local clients can skip the TCP stack through a Unix domain socket
+	if (unixPath != NULL) {listenFDs[listeners++] = OTP_listenUnix(unixPath, backlog);}
+
+	// Set up the address struct for this process (the server)
+	memset((char *)&serverAddress, '\0', sizeof(serverAddress)); // Clear out the address struct
+	portNumber = tcp ? atoi(argv[1]) : 0; // Get the port number, convert to an integer from a string
+	serverAddress.sin_family = AF_INET; // Create a network-capable socket
+	serverAddress.sin_port = htons(portNumber); // Store the port number
+	serverAddress.sin_addr.s_addr = INADDR_ANY; // Any address is allowed for connection to this process
+
+	// In prefork mode long-lived workers, each with its own socket on
+	// the port, serve many requests apiece while this process supervises
+	if (workers > 0) {return OTP_runPrefork(tcp ? &serverAddress : NULL, unixPath != NULL ? listenFDs[0] : -1, workers, &service);}
+
+	if (tcp)
+	{
+		// Set up the socket
+		listenSocketFD = socket(AF_INET, SOCK_STREAM, 0); // Create the socket
+		if (listenSocketFD < 0) OTP_fatal("ERROR opening socket");
+
+		// Enable the socket to begin listening
+		if (bind(listenSocketFD, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0) // Connect socket to port
+			OTP_fatal("ERROR on binding");
+		listen(listenSocketFD, backlog); // Flip the socket on - it can now receive connections
+		listenFDs[listeners++] = listenSocketFD;
+	}
+
+	// In reactor mode this one process serves every connection through
+	// epoll, with no fork per request
+	if (reactor) {return OTP_runReactor(listenFDs, listeners, &service);}
+	// The io_uring backend batches the syscalls of every connection; on
+	// a kernel without it, serve through epoll instead
+	if (uring && OTP_runUring(listenFDs, listeners, &service) < 0)
+	{
+		fprintf(stderr, "SERVER: io_uring unavailable, using epoll\n");
+		return OTP_runReactor(listenFDs, listeners, &service);
+	}
+	// In threads mode a pool of threads serves the connections, each
+	// stealing work from the others when its own queue is empty
+	if (threads >= 0) {return OTP_runThreads(listenFDs, listeners, threads, &service);}
+
+	// Otherwise a child is forked to serve each connection, up to the
+	// limit at once. Past it connections wait their turn in a bounded
+	// queue, and past that they are refused busy.
+	int limit = service.limit > 0 ? service.limit : OTP_MAX_CONNECTIONS;
+	int queue = service.queue >= 0 ? service.queue : OTP_QUEUE_DEFAULT;
+	struct WaitQueue waiting = {malloc((queue + 1) * sizeof(int)), 0, 0, queue};
+	int children = 0;
+
+	// Children exiting arrive as reads on a signalfd, waited on along
+	// with the listeners, so each is reaped and its slot handed on the
+	// moment it finishes rather than when the next client connects
+	sigset_t childSignal;
+	sigemptyset(&childSignal);
+	sigaddset(&childSignal, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &childSignal, NULL);
+	int childFD = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (childFD < 0) OTP_fatal("ERROR opening signalfd");
+
+	do
+	{
+		// Reap the finished children, and give their slots to the
+		// connections waiting longest. Exits close together share one
+		// signal, so reap until none are left rather than once per read.
+		struct signalfd_siginfo exited;
+		while (read(childFD, &exited, sizeof(exited)) == sizeof(exited));
+		while (waitpid(-1, NULL, WNOHANG) > 0) {children--;}
+		while (children < limit && waiting.count > 0)
+		{
+			children += spawnChild(waiting.fds[waiting.head], listenFDs, listeners, &waiting, childFD, &service) > 0;
+			waiting.head = (waiting.head + 1) % queue;
+			waiting.count--;
+			OTP_statsGauge(service.stats, OTP_STAT_QUEUED, -1);
+		}
+
+		// Accept a connection, blocking if one is not available until one connects
+		establishedConnectionFD = OTP_acceptAny(listenFDs, listeners, childFD);
+		if (establishedConnectionFD < 0) {continue;}
+
+		if (children < limit) {children += spawnChild(establishedConnectionFD, listenFDs, listeners, &waiting, childFD, &service) > 0;}
+		else if (waiting.count < queue)
+		{
+			waiting.fds[(waiting.head + waiting.count++) % queue] = establishedConnectionFD;
+			OTP_statsGauge(service.stats, OTP_STAT_QUEUED, 1);
+		}
+		else {OTP_refuseBusy(&service, establishedConnectionFD, waiting.count);}
+	} while(1);
+
+	for (index = 0; index < listeners; index++) {close(listenFDs[index]);} // Close the listening sockets
+	close(childFD);
+	free(waiting.fds);
+
+	// catch all remaining children
+	while (children-- > 0) {wait(NULL);}
+	return 0; 
+}
+
+/*********************************************************************
+ * pid_t spawnChild(int connectionFD, const int listenFDs[], int listeners, const struct WaitQueue* waiting, int childFD, const struct OTP_Service* service)
+ *  Forks a child to serve a connection, then closes this process's
+ *  copy of it. If no child can be forked, refuses it busy instead.
+ * Arguments:
+ *  int connectionFD - the accepted connection
+ *  const int listenFDs[] - the listening sockets, which the child closes
+ *  int listeners - the number of listening sockets
+ *  const struct WaitQueue* waiting - the queued connections, which the
+ *  	child closes too, bar connectionFD if it was one of them
+ *  int childFD - the signalfd for exiting children, also closed
+ *  const struct OTP_Service* service - what the daemon offers
+ * Returns:
+ * 	pid_t - the child, or -1 if the connection was refused
+*********************************************************************/
+pid_t spawnChild(int connectionFD, const int listenFDs[], int listeners, const struct WaitQueue* waiting, int childFD, const struct OTP_Service* service)
+{
+	pid_t spawnPID = fork();
+	if (spawnPID < 0)
+	{
+		perror("SERVER: fork");
+		OTP_refuseBusy(service, connectionFD, 0);
+		return -1;
+	}
+
+	// Get the files, encode or decode the message, send the result
+	if (spawnPID == 0)
+	{
+		int index;
+		for (index = 0; index < listeners; index++) {close(listenFDs[index]);}
+		// Otherwise a queued client's connection would outlive its own
+		// child, until every child forked while it waited had exited
+		for (index = 0; index < waiting->count; index++)
+		{
+			int waitingFD = waiting->fds[(waiting->head + index) % waiting->size];
+			if (waitingFD != connectionFD) {close(waitingFD);}
+		}
+		close(childFD);
+		struct OTP_Session session;
+		OTP_sessionInit(&session, connectionFD, service, OTP_CHUNK_MAX);
+		OTP_statsConnection(service->stats, 1);
+		int result = OTP_serveSession(&session);
+		OTP_statsConnection(service->stats, 0);
+
+		OTP_sessionFree(&session);
+		close(connectionFD); // Close the existing socket which is connected to the client
+		exit(result < 0 ? 1 : 0);
+	}
+
+	close(connectionFD); // The child has its own copy
+	return spawnPID;
+}
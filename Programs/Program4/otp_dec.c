@@ -4,11 +4,27 @@
 ** Date:            12/1/2019
 ** Description:     Program 4 for CS344 Operating Systems @ OSU
 **  Program Function:
-**		Usage: otp_dec [ciphertext] [key] [port]
+**		Usage: otp_dec [-m mode] ciphertext key [ciphertext key ...] port|path
+**		       otp_dec [-m mode] -u key port|path
+**		       otp_dec -s port|path
+**		       otp_dec --local [-m mode] ciphertext key [ciphertext key ...]
 **		otp_dec works with otp_dec_d to decode a ciphertext file
 **		into plaintext, using a provided key. This program serves
 **		as the client, where the user runs this program to recieve
 **		the decoded text.
+**		Given several ciphertext/key pairs, it sends them all over one
+**		connection without waiting for each result, and prints the
+**		results in order. A socket path in place of the port
+**		reaches a daemon listening with --unix. A daemon too busy to
+**		take the connection is tried again after a jittered backoff.
+**		With -s it prints the daemon's metrics instead.
+**		With --local it runs the codec in this process from libotp,
+**		over memory mappings of the files, with no daemon; the output
+**		is byte for byte what the daemon would have sent.
+**		With -u it stores the key in a daemon started with --keys and
+**		prints the name it goes by, "@id". A key given as "@id:offset"
+**		then uses the stored key from that offset on - the offset
+**		otp_enc printed when it encoded the ciphertext.
 **		Code adapted from server.h from Program 4 Lecture
 *********************************************************************/
 #include <stdio.h>
@@ -19,121 +35,196 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <getopt.h>
 
 #include "otp_helpers.h"
 #define h_addr h_addr_list[0]
 
 // File Validation
-int checkFile(char* fileName);
-void validateFiles(char* ciphertext, char* key);
-// Client Function
-int sendFile(char* source, char* fileName, char buffer[], char* termString, int socketFD);
+size_t checkFile(char* fileName, int mode, int* fileFD);
+void validateFiles(char* ciphertext, char* key, int mode, int fileFDs[], size_t counts[], unsigned long* keyID, size_t* keyOffset);
+// Client Functions
+int sendFile(int fileFD, size_t count, int opcode, size_t chunkSize, unsigned long requestID, int socketFD);
+void* sendRequests(void* arguments);
+int storeKey(char* keyName, int mode, int decoding, char* destination);
+int printStats(char* destination);
+
+// The requests a connection carries, uploaded by their own thread so
+// results can be read while later requests are still being sent
+struct RequestList {
+	int socketFD;
+	size_t chunkSize;
+	int jobs;
+	int* fileFDs;		// Input then key for each job
+	size_t* counts;
+	unsigned long* keyIDs;	// Stored key of each job, 0 for a key file
+	size_t* keyOffsets;
+};
+
+// Running Jobs Without a Daemon
+int runLocal(struct RequestList* requests, int mode, int decoding);
 
 int main(int argc, char *argv[])
 {
-	char* clientVerifier = "OTP_DEC";
-	char* terminationString = "$OTP_TERMINATE";
-	char* source = "CLIENT";
+	int decoding = 1; // Ask the daemon to decode
+
+	int socketFD;
+	char* destination;
+	size_t chunkSize = OTP_CHUNK_MAX; // Upload in the largest ranges the daemon allows
+	int jobs;
+	int exitStatus = 0;
+	int mode = OTP_MODE_ALPHA27;
 
-	int socketFD, portNumber, charsWritten, charsRead;
-	struct sockaddr_in serverAddress;
-	struct hostent* serverHostInfo;
-	char buffer[OTP_BUFFERSIZE];
-    
-	if (argc < 4) { fprintf(stderr,"USAGE: %s [ciphertext] [key] [port]\n", argv[0]); exit(0); } // Check usage & args
+	// Get the alphabet mode, if one was given
+	int option;
+	char* upload = NULL;
+	int stats = 0, local = 0;
+	struct option options[] = {{"local", no_argument, &local, 1}, {0, 0, 0, 0}};
+	while ((option = getopt_long(argc, argv, "m:u:s", options, NULL)) != -1)
+	{
+		if (option == 0) {continue;}
+		if (option == 'm' && (mode = OTP_parseMode(optarg)) >= 0) {continue;}
+		if (option == 'u') {upload = optarg; continue;}
+		if (option == 's') {stats = 1; continue;}
+		fprintf(stderr, "USAGE: %s [-m alpha27|printable|raw] ciphertext key [ciphertext key ...] port|path\n", argv[0]); exit(1);
+	}
+	// Show the daemon's metrics instead, if asked to
+	if (stats)
+	{
+		if (argc - optind != 1) { fprintf(stderr,"USAGE: %s -s port|path\n", argv[0]); exit(1); }
+		return printStats(argv[optind]);
+	}
+	// Store a key in the daemon instead, if asked to
+	if (upload != NULL)
+	{
+		if (argc - optind != 1) { fprintf(stderr,"USAGE: %s [-m alpha27|printable|raw] -u key port|path\n", argv[0]); exit(1); }
+		return storeKey(upload, mode, decoding, argv[optind]);
+	}
+	if (argc - optind < 3 - local || (argc - optind + local) % 2 == 0) { fprintf(stderr,"USAGE: %s [-m alpha27|printable|raw] ciphertext key [ciphertext key ...] port|path\n       %s --local [-m alpha27|printable|raw] ciphertext key [ciphertext key ...]\n", argv[0], argv[0]); exit(0); } // Check usage & args
+	argv += optind - 1; // Skip past the options so the files start at argv[1]
+	jobs = (argc - optind) / 2;
+
+	// Every job holds two files open until it is sent
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
 
 	// Check files for bad characters and proper lengths
-	validateFiles(argv[1], argv[2]);
-
-	// Set up the server address struct
-	memset((char*)&serverAddress, '\0', sizeof(serverAddress)); // Clear out the address struct
-	portNumber = atoi(argv[3]); // Get the port number, convert to an integer from a string
-	serverAddress.sin_family = AF_INET; // Create a network-capable socket
-	serverAddress.sin_port = htons(portNumber); // Store the port number
-	serverHostInfo = gethostbyname("localhost"); // Convert the machine name into a special form of address
-	if (serverHostInfo == NULL) { fprintf(stderr, "CLIENT: ERROR, no such host\n"); exit(0); }
-	memcpy((char*)&serverAddress.sin_addr.s_addr, (char*)serverHostInfo->h_addr, serverHostInfo->h_length); // Copy in the address
-
-	// Set up the socket
-	socketFD = socket(AF_INET, SOCK_STREAM, 0); // Create the socket
-	if (socketFD < 0) error("CLIENT: ERROR opening socket");
-	
-	// Connect to server
-	if (connect(socketFD, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) // Connect socket to address
-		error("CLIENT: ERROR connecting");
-
-	// Send verifier to server and get response
-	sendMessage(source, clientVerifier, socketFD);
-	getResponse(source, buffer, socketFD);
-	// If server sends unsuccessful response, print error and exit.
-	if (atoi(buffer) != 200)
+	struct RequestList requests;
+	requests.jobs = jobs;
+	requests.fileFDs = malloc(2 * jobs * sizeof(int));
+	requests.counts = malloc(2 * jobs * sizeof(size_t));
+	requests.keyIDs = malloc(jobs * sizeof(unsigned long));
+	requests.keyOffsets = malloc(jobs * sizeof(size_t));
+	int job;
+	for (job = 0; job < jobs; job++)
 	{
-		fprintf(stderr, "Error: could not contact opt_dec_d on port %d\n", portNumber);
-		exit(2);
+		validateFiles(argv[2 * job + 1], argv[2 * job + 2], mode, requests.fileFDs + 2 * job, requests.counts + 2 * job, &requests.keyIDs[job], &requests.keyOffsets[job]);
 	}
 
-	// Send ciphertext to server
-	sendFile(source, argv[1], buffer, terminationString, socketFD);
+	// With --local there is no daemon: the jobs run here, in order
+	if (local)
+	{
+		exitStatus = runLocal(&requests, mode, decoding);
+		free(requests.fileFDs);
+		free(requests.counts);
+		free(requests.keyIDs);
+		free(requests.keyOffsets);
+		return exitStatus;
+	}
 
-	// Send keygen to server
-	sendFile(source, argv[2], buffer, terminationString, socketFD);
+	// Connect to the daemon by its port, or by its socket path if it
+	// listens on a Unix domain socket
+	destination = argv[2 * jobs + 1];
 
-	// Get plaintext and print to stdout
-	while(1)
+	// Ask for the operation and mode, and agree on a chunk size, backing
+	// off and trying again while the daemon is too busy to take us
+	if ((socketFD = OTP_clientOpen(destination, decoding, mode, &chunkSize)) < 0)
 	{
-		getResponse(source, buffer, socketFD);
-		sendMessage(source, "200", socketFD);
+		fprintf(stderr, "Error: could not contact opt_dec_d %s %s\n", OTP_isSocketPath(destination) ? "at" : "on port", destination);
+		exit(2);
+	}
 
-		// If not termination string, print the buffer
-		if (strcmp(buffer, terminationString))
-		{
-			printf("%s", buffer);
-		}
-		// Otherwise, exit the loop
-		else
+	// Send every job on its own thread, while this one reads results
+	requests.socketFD = socketFD;
+	requests.chunkSize = chunkSize;
+	pthread_t sender;
+	if (pthread_create(&sender, NULL, sendRequests, &requests) != 0) OTP_fatal("CLIENT: ERROR starting sender");
+
+	// Get each plaintext and print to stdout, in the order the jobs were given
+	char* buffer = malloc(chunkSize);
+	struct OTP_Frame frame;
+	for (job = 0; job < jobs; job++)
+	{
+		do
 		{
-			break;
-		}
+			if (OTP_recvFrame(socketFD, &frame, buffer, chunkSize) < 0 || frame.requestID != (unsigned long) job + 1) { fprintf(stderr, "CLIENT: ERROR reading from socket\n"); exit(1); }
+
+			// If the server rejected the input, report where
+			if (frame.opcode == OTP_OP_ERROR)
+			{
+				size_t offset;
+				int code = OTP_parseError(buffer, frame.length, &offset);
+				// A missing key has no offset worth naming
+				if (code == OTP_ERR_NOKEY) {fprintf(stderr, "Error: %s\n", OTP_errorString(code));}
+				else {fprintf(stderr, "Error: %s at offset %zu\n", OTP_errorString(code), offset);}
+				exitStatus = 1;
+			}
+			// Otherwise, print the data
+			else
+			{
+				fwrite(buffer, sizeof(char), frame.length, stdout);
+			}
+		} while (!(frame.flags & OTP_FLAG_END)); // Exit the loop after the last frame
 	}
 
+	pthread_join(sender, NULL);
+	free(requests.fileFDs);
+	free(requests.counts);
+	free(requests.keyIDs);
+	free(requests.keyOffsets);
+	free(buffer);
 	close(socketFD); // Close the socket
-	return 0;
+	return exitStatus;
 }
 
 /*********************************************************************
- * int checkFile(char* fileName)
- *  Makes sure the file only has valid characters
+ * size_t checkFile(char* fileName, int mode, int* fileFD)
+ *  Makes sure the file only has valid characters, scanning a memory
+ *  mapping of the whole file in one pass. The file is left open so it
+ *  can be uploaded straight from the pages the scan brought in.
  * Arguments:
  * 	char* fileName - the name of the file
+ *  int mode - the OTP_MODE alphabet the file must use
+ *  int* fileFD - where the open file descriptor is stored
  * Returns:
- * 	int count - the number of characters in the file.
+ * 	size_t count - the number of characters in the file.
 *********************************************************************/
-int checkFile(char* fileName)
+size_t checkFile(char* fileName, int mode, int* fileFD)
 {
-    int character;  // holds the integer value of the character
-    int count = 0;  // holds the number of characters in the file
+    size_t count;      // holds the number of characters in the file
+    size_t badOffset;  // holds the offset of the first invalid character
 
     // Open the file
-    FILE* fileInput = fopen(fileName, "r");
+    *fileFD = open(fileName, O_RDONLY);
+    int result = *fileFD < 0 ? OTP_ERR_FILE : OTP_validateFd(*fileFD, mode, &count, &badOffset);
     // Check if valid
-    if (fileInput == NULL) { fprintf(stderr,"ERROR failed to open '%s'\n", fileName); exit(1); }
-
-    // Go through the file
-    while ((character = fgetc(fileInput)) != EOF)
+    if (result == OTP_ERR_FILE) { fprintf(stderr,"ERROR failed to open '%s'\n", fileName); exit(1); }
+    // If an invalid character is detected, print error and exit
+    if (result != OTP_SUCCESS)
     {
-        // If an invalid character is detected, print error and exit
-        if ((character < 'A' || character > 'Z') && character != ' ' && character != '\n')
-        {
-            fprintf(stderr,"ERROR '%s' contains invalid characters\n", fileName);
-            exit(1);
-        }
-        count++;
+        fprintf(stderr,"ERROR '%s' contains invalid characters\n", fileName);
+        exit(1);
     }
 
-    // Close the file
-    fclose(fileInput);
-
     return count;
 }
 
@@ -143,12 +234,32 @@ int checkFile(char* fileName)
  * Arguments:
  * 	char* cipher - the ciphertext file to be encoded
  *  char* key - the keyfile to be used to encode the ciphertext file.
+ *  int mode - the OTP_MODE alphabet the files must use
+ *  int fileFDs[] - where the two open file descriptors are stored
+ *  size_t counts[] - where the two file lengths are stored
+ *  unsigned long* keyID - where the stored key's ID is stored, 0 if
+ *  	key names a file
+ *  size_t* keyOffset - where the stored key's offset is stored
 *********************************************************************/
-void validateFiles(char* ciphertext, char* key)
+void validateFiles(char* ciphertext, char* key, int mode, int fileFDs[], size_t counts[], unsigned long* keyID, size_t* keyOffset)
 {
+    // A key named "@id" or "@id:offset" is in the daemon's key store,
+    // which checks it there
+    *keyID = 0;
+    int stored = OTP_parseKeyName(key, keyID, keyOffset);
+    if (stored < 0) { fprintf(stderr, "Error: '%s' is not a stored key name\n", key); exit(1); }
+    if (stored && *keyOffset == OTP_KEY_NEXT) { fprintf(stderr, "Error: stored key '%s' needs the offset it encoded with, as @id:offset\n", key); exit(1); }
+    if (stored)
+    {
+        counts[0] = checkFile(ciphertext, mode, &fileFDs[0]);
+        fileFDs[1] = -1;
+        counts[1] = 0;
+        return;
+    }
+
     // Check if files are valid and record number of characters
-    int ciphertextCount = checkFile(ciphertext);
-    int keyCount = checkFile(key);
+    size_t ciphertextCount = counts[0] = checkFile(ciphertext, mode, &fileFDs[0]);
+    size_t keyCount = counts[1] = checkFile(key, mode, &fileFDs[1]);
 
     // If the key file is shorter than the ciphertext, terminate and send error
     if (keyCount < ciphertextCount)
@@ -159,42 +270,168 @@ void validateFiles(char* ciphertext, char* key)
 }
 
 /*********************************************************************
- * int sendFile(char* source, char* fileName, char buffer[], char* termString, int socketFD)
- *  Sends a file to the server
+ * int sendFile(int fileFD, size_t count, int opcode, size_t chunkSize, unsigned long requestID, int socketFD)
+ *  Sends a file to the server as frames of at most chunkSize bytes,
+ *  followed by an empty frame marking the end. The kernel copies the
+ *  file to the socket, so its bytes never pass through this program.
  * Arguments:
- * 	char* source - whether the program is the server or client
- *  char* fileName - the name of the file to send
- *  char* buffer[] - the buffer that holds the text to send
- *  char* termString - the termination string to indicate completion
+ *  int fileFD - the open file to send, which is closed afterwards
+ *  size_t count - the number of bytes in the file
+ *  int opcode - OTP_OP_TEXT or OTP_OP_KEY
+ *  size_t chunkSize - the agreed chunk size
+ *  unsigned long requestID - the request the file belongs to
  *  int socketFD - the socket for the connection.
  * Returns:
  * 	0 if successful
 *********************************************************************/
-int sendFile(char* source, char* fileName, char buffer[], char* termString, int socketFD)
+int sendFile(int fileFD, size_t count, int opcode, size_t chunkSize, unsigned long requestID, int socketFD)
+{
+	OTP_sendFileFrames(socketFD, opcode, fileFD, count, chunkSize, requestID);
+	// Close File
+	close(fileFD);
+
+	return 0;
+}
+
+/*********************************************************************
+ * void* sendRequests(void* arguments)
+ *  Sends each job's ciphertext and then its key, numbering the jobs'
+ *  requests from 1, without waiting for any result
+ * Arguments:
+ *  void* arguments - the struct RequestList to send
+ * Returns:
+ * 	NULL
+*********************************************************************/
+void* sendRequests(void* arguments)
+{
+	struct RequestList* requests = arguments;
+	int job;
+	for (job = 0; job < requests->jobs; job++)
+	{
+		sendFile(requests->fileFDs[2 * job], requests->counts[2 * job], OTP_OP_TEXT, requests->chunkSize, job + 1, requests->socketFD);
+		if (requests->keyIDs[job] == 0)
+		{
+			sendFile(requests->fileFDs[2 * job + 1], requests->counts[2 * job + 1], OTP_OP_KEY, requests->chunkSize, job + 1, requests->socketFD);
+			continue;
+		}
+
+		// A stored key is named in place of being sent
+		char payload[OTP_KEYREF_SIZE];
+		OTP_packKeyRef(payload, requests->keyIDs[job], requests->keyOffsets[job]);
+		OTP_sendFrame(requests->socketFD, OTP_OP_KEYREF, OTP_FLAG_END, payload, OTP_KEYREF_SIZE, job + 1);
+	}
+	return NULL;
+}
+
+/*********************************************************************
+ * int storeKey(char* keyName, int mode, int decoding, char* destination)
+ *  Uploads a key file to the daemon's key store, and prints the name
+ *  requests can use it by from then on
+ * Arguments:
+ *  char* keyName - the key file
+ *  int mode - the OTP_MODE alphabet the key must use
+ *  int decoding - the operation to ask the daemon for
+ *  char* destination - the daemon's port or socket path
+ * Returns:
+ * 	int - the exit status
+*********************************************************************/
+int storeKey(char* keyName, int mode, int decoding, char* destination)
 {
+	int fileFD;
+	size_t chunkSize = OTP_CHUNK_MAX, badOffset;
+	unsigned long keyID;
+	size_t count = checkFile(keyName, mode, &fileFD);
 
-	FILE* fileInput = fopen(fileName, "r"); // Open ciphertext file
-	memset(buffer, '\0', OTP_BUFFERSIZE); // Clear out the buffer array
+	int socketFD = OTP_clientOpen(destination, decoding, mode, &chunkSize);
+	if (socketFD < 0)
+	{
+		fprintf(stderr, "Error: could not contact opt_dec_d %s %s\n", OTP_isSocketPath(destination) ? "at" : "on port", destination);
+		exit(2);
+	}
 
-	int count = 0;
+	int result = OTP_uploadKey(socketFD, fileFD, count, chunkSize, &keyID, &badOffset);
+	close(socketFD); // Close the socket
+	if (result != OTP_SUCCESS)
+	{
+		if (result == OTP_ERR_NOKEY) {fprintf(stderr, "Error: %s\n", OTP_errorString(result));}
+		else {fprintf(stderr, "Error: %s at offset %zu\n", OTP_errorString(result), badOffset);}
+		return 1;
+	}
+	printf("@%lu\n", keyID);
+	return 0;
+}
 
-	char fileBuffer[OTP_BUFFERSIZE];
-	while(fgets(fileBuffer, OTP_BUFFERSIZE, fileInput))
+/*********************************************************************
+ * int printStats(char* destination)
+ *  Prints the daemon's counters, gauges and latency percentiles
+ * Arguments:
+ *  char* destination - the daemon's port or socket path
+ * Returns:
+ * 	int - the exit status
+*********************************************************************/
+int printStats(char* destination)
+{
+	struct OTP_Buffer text;
+	OTP_bufferInit(&text, 0);
+
+	int socketFD = OTP_connectTo(destination);
+	int result = OTP_requestStats(socketFD, &text);
+	close(socketFD); // Close the socket
+	if (result < 0)
 	{
-		count++;
-		
-		// Send message to server
-		sendMessage(source, fileBuffer, socketFD);
-		// Get return message from server
-		getResponse(source, buffer, socketFD);
-
-		memset(buffer, '\0', OTP_BUFFERSIZE); // Clear out the buffer array
+		fprintf(stderr, "Error: could not contact opt_dec_d %s %s\n", OTP_isSocketPath(destination) ? "at" : "on port", destination);
+		exit(2);
 	}
-	// Send Termination Signal
-	sendMessage(source, termString, socketFD);
-	getResponse(source, buffer, socketFD);
-	// Close File
-	fclose(fileInput);
-	
+	fwrite(text.data, sizeof(char), text.length, stdout);
+	OTP_bufferFree(&text);
 	return 0;
-}
\ No newline at end of file
+}
+
+/*********************************************************************
+ * int runLocal(struct RequestList* requests, int mode, int decoding)
+ *  Runs each job through libotp's codec in this process, in place of
+ *  the daemon, and prints the results in order just as they would
+ *  have come back from it
+ * Arguments:
+ *  struct RequestList* requests - the validated jobs
+ *  int mode - the OTP_MODE alphabet
+ *  int decoding - 0 to encode, 1 to decode
+ * Returns:
+ * 	int - the exit status
+*********************************************************************/
+int runLocal(struct RequestList* requests, int mode, int decoding)
+{
+	struct OTP_Buffer result;
+	OTP_bufferInit(&result, 0);
+	int job, exitStatus = 0;
+
+	for (job = 0; job < requests->jobs; job++)
+	{
+		int* fileFDs = requests->fileFDs + 2 * job;
+		size_t* counts = requests->counts + 2 * job;
+		size_t offset;
+
+		// Stored keys live in the daemon
+		if (requests->keyIDs[job] != 0)
+		{
+			fprintf(stderr, "Error: stored keys need a daemon, not --local\n");
+			close(fileFDs[0]);
+			exitStatus = 1;
+			continue;
+		}
+
+		result.length = 0;
+		int code = OTP_streamFiles(mode, decoding, fileFDs[0], counts[0], fileFDs[1], counts[1], &result, &offset);
+		close(fileFDs[0]);
+		close(fileFDs[1]);
+		if (code != OTP_SUCCESS)
+		{
+			fprintf(stderr, "Error: %s at offset %zu\n", OTP_errorString(code), offset);
+			exitStatus = 1;
+			continue;
+		}
+		fwrite(result.data, sizeof(char), result.length, stdout);
+	}
+	OTP_bufferFree(&result);
+	return exitStatus;
+}
@@ -16,127 +16,1677 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
-#include <sys/ioctl.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <limits.h>
+#include <poll.h>
+#include <errno.h>
 #include <sys/wait.h>
+#include <pthread.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "otp_helpers.h"
 
-void error(const char *msg) { perror(msg); exit(1); } // Error function used for reporting issues
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // Linux's limit, for when limits.h doesn't expose it
+#endif
+
+void OTP_fatal(const char *msg) { perror(msg); exit(1); } // Error function used for reporting issues
+
+// Big endian field packing for frame headers and payloads
+static void _putUint16(char* out, unsigned value) { out[0] = value >> 8; out[1] = value; }
+static void _putUint32(char* out, unsigned long value) { _putUint16(out, value >> 16); _putUint16(out + 2, value & 0xFFFF); }
+static unsigned _getUint16(const char* in) { return ((unsigned char) in[0] << 8) | (unsigned char) in[1]; }
+static unsigned long _getUint32(const char* in) { return ((unsigned long) _getUint16(in) << 16) | _getUint16(in + 2); }
+
+/*********************************************************************
+ * static int _waitReady(int fileDescriptor, short events)
+ *  Blocks until a non-blocking descriptor can make progress again
+ * Returns:
+ * 	0 once ready, -1 on failure
+*********************************************************************/
+static int _waitReady(int fileDescriptor, short events)
+{
+	struct pollfd ready = {fileDescriptor, events, 0};
+	while (poll(&ready, 1, -1) < 0)
+	{
+		if (errno != EINTR) {return -1;}
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_sendAllv(int fileDescriptor, struct iovec* pieces, int count)
+ *  Sends every byte of several buffers, gathered into as few writev
+ *  calls as the socket allows. Partial writes are resumed where they
+ *  stopped, interrupted calls are retried, and on a non-blocking
+ *  socket a full send queue is waited out.
+ * Arguments:
+ * 	int fileDescriptor - the file descriptor of the connection
+ *  struct iovec* pieces - the buffers to send, in order; they are
+ *  	advanced past whatever has been sent
+ *  int count - the number of buffers
+ * Returns:
+ * 	0 on success, -1 if the connection failed
+*********************************************************************/
+int OTP_sendAllv(int fileDescriptor, struct iovec* pieces, int count)
+{
+	while (count > 0)
+	{
+		// Skip past buffers that are already sent
+		if (pieces->iov_len == 0) {pieces++; count--; continue;}
+
+		ssize_t charsWritten = writev(fileDescriptor, pieces, count < IOV_MAX ? count : IOV_MAX);
+		if (charsWritten < 0)
+		{
+			if (errno == EINTR) {continue;}
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && _waitReady(fileDescriptor, POLLOUT) == 0) {continue;}
+			return -1;
+		}
+
+		// Advance through the buffers by however much went out
+		while (count > 0 && (size_t) charsWritten >= pieces->iov_len)
+		{
+			charsWritten -= pieces->iov_len;
+			pieces++;
+			count--;
+		}
+		if (count > 0)
+		{
+			pieces->iov_base = (char*) pieces->iov_base + charsWritten;
+			pieces->iov_len -= charsWritten;
+		}
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_sendAll(int fileDescriptor, const char* data, size_t length)
+ *  Sends every byte of a buffer, as OTP_sendAllv does
+ * Arguments:
+ * 	int fileDescriptor - the file descriptor of the connection
+ *  const char* data - the bytes to send
+ *  size_t length - the number of bytes to send
+ * Returns:
+ * 	0 on success, -1 if the connection failed
+*********************************************************************/
+int OTP_sendAll(int fileDescriptor, const char* data, size_t length)
+{
+	struct iovec piece = {(void*) data, length};
+	return OTP_sendAllv(fileDescriptor, &piece, 1);
+}
+
+/*********************************************************************
+ * int OTP_recvExact(int fileDescriptor, char* data, size_t length)
+ *  Receives exactly length bytes, resuming after short reads and
+ *  interrupted calls, and waiting on a non-blocking socket
+ * Arguments:
+ * 	int fileDescriptor - the file descriptor of the connection
+ *  char* data - where the bytes are stored
+ *  size_t length - the number of bytes to receive
+ * Returns:
+ * 	0 on success, -1 if the connection closed or failed first
+*********************************************************************/
+int OTP_recvExact(int fileDescriptor, char* data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t charsRead = recv(fileDescriptor, data, length, 0);
+		if (charsRead == 0) {return -1;}
+		if (charsRead < 0)
+		{
+			if (errno == EINTR) {continue;}
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && _waitReady(fileDescriptor, POLLIN) == 0) {continue;}
+			return -1;
+		}
+		data += charsRead;
+		length -= charsRead;
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * void OTP_packHeader(char header[], int opcode, int flags, size_t length, unsigned long requestID)
+ *  Writes a frame header for the current protocol version
+ * Arguments:
+ * 	char header[] - where the OTP_FRAME_HEADER bytes are stored
+ *  int opcode - the OTP_OP of the frame
+ *  int flags - OTP_FLAG bits for the frame
+ *  size_t length - the number of payload bytes after the header
+ *  unsigned long requestID - the request the frame belongs to, 0 for
+ *  	the handshake
+*********************************************************************/
+void OTP_packHeader(char header[], int opcode, int flags, size_t length, unsigned long requestID)
+{
+	header[0] = OTP_PROTOCOL_VERSION;
+	header[1] = opcode;
+	_putUint16(header + 2, flags);
+	_putUint32(header + 4, length);
+	_putUint32(header + 8, requestID);
+}
+
+/*********************************************************************
+ * int OTP_unpackHeader(const char header[], struct OTP_Frame* frame)
+ *  Reads a frame header
+ * Arguments:
+ * 	const char header[] - the OTP_FRAME_HEADER bytes
+ *  struct OTP_Frame* frame - where the decoded header is stored
+ * Returns:
+ * 	0 on success, -1 if the header is from another protocol version
+*********************************************************************/
+int OTP_unpackHeader(const char header[], struct OTP_Frame* frame)
+{
+	frame->opcode = (unsigned char) header[1];
+	frame->flags = _getUint16(header + 2);
+	frame->length = _getUint32(header + 4);
+	frame->requestID = _getUint32(header + 8);
+
+	return header[0] == OTP_PROTOCOL_VERSION ? 0 : -1;
+}
+
+/*********************************************************************
+ * int OTP_sendFrame(int fileDescriptor, int opcode, int flags, const char* payload, size_t length, unsigned long requestID)
+ *  Sends one frame to the connection
+ * Arguments:
+ * 	int fileDescriptor - the file descriptor of the connection
+ *  int opcode - the OTP_OP of the frame
+ *  int flags - OTP_FLAG bits for the frame
+ *  const char* payload - the payload bytes (may be NULL if length is 0)
+ *  size_t length - the number of payload bytes
+ *  unsigned long requestID - the request the frame belongs to
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_sendFrame(int fileDescriptor, int opcode, int flags, const char* payload, size_t length, unsigned long requestID)
+{
+	char header[OTP_FRAME_HEADER];
+	OTP_packHeader(header, opcode, flags, length, requestID);
+
+	// Send the header and payload together in one call
+	struct iovec pieces[2] = {{header, OTP_FRAME_HEADER}, {(void*) payload, length}};
+	if (OTP_sendAllv(fileDescriptor, pieces, 2) < 0) OTP_fatal("ERROR writing to socket");
+
+	return 0;
+}
+
+/*********************************************************************
+ * static int _sendMore(int socketFD, const char* data, size_t length)
+ *  Sends every byte, telling the kernel more data follows so a header
+ *  leaves in the same packet as its payload
+*********************************************************************/
+static int _sendMore(int socketFD, const char* data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t charsWritten = send(socketFD, data, length, MSG_MORE);
+		if (charsWritten < 0)
+		{
+			if (errno == EINTR) {continue;}
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && _waitReady(socketFD, POLLOUT) == 0) {continue;}
+			return -1;
+		}
+		data += charsWritten;
+		length -= charsWritten;
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * static int _sendFileRange(int socketFD, int fileDescriptor, off_t offset, size_t length)
+ *  Has the kernel copy a range of a file straight to the socket with
+ *  sendfile, or reads and sends it where sendfile isn't supported
+ * Returns:
+ * 	0 on success, -1 if the connection or file failed
+*********************************************************************/
+static int _sendFileRange(int socketFD, int fileDescriptor, off_t offset, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t charsWritten = sendfile(socketFD, fileDescriptor, &offset, length);
+		if (charsWritten > 0) {length -= charsWritten; continue;}
+		if (charsWritten == 0) {return -1;} // The file shrank underneath us
+		if (errno == EINTR) {continue;}
+		if ((errno == EAGAIN || errno == EWOULDBLOCK) && _waitReady(socketFD, POLLOUT) == 0) {continue;}
+		if (errno != EINVAL && errno != ENOSYS) {return -1;}
+
+		// Copy through user space instead
+		char buffer[OTP_CHUNK_MIN * 16];
+		ssize_t charsRead = pread(fileDescriptor, buffer, length < sizeof(buffer) ? length : sizeof(buffer), offset);
+		if (charsRead <= 0 || OTP_sendAll(socketFD, buffer, charsRead) < 0) {return -1;}
+		offset += charsRead;
+		length -= charsRead;
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_sendFileFrames(int socketFD, int opcode, int fileDescriptor, size_t length, size_t chunkSize, unsigned long requestID)
+ *  Uploads a whole file as frames of at most chunkSize bytes, then an
+ *  empty frame marking the end. Only the headers pass through user
+ *  space; the file's bytes go from the page cache to the socket.
+ * Arguments:
+ * 	int socketFD - the file descriptor of the connection
+ *  int opcode - the OTP_OP of the frames
+ *  int fileDescriptor - the open file
+ *  size_t length - the number of bytes in the file
+ *  size_t chunkSize - the agreed chunk size
+ *  unsigned long requestID - the request the file belongs to
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_sendFileFrames(int socketFD, int opcode, int fileDescriptor, size_t length, size_t chunkSize, unsigned long requestID)
+{
+	size_t offset;
+	for (offset = 0; offset < length; offset += chunkSize)
+	{
+		size_t count = length - offset < chunkSize ? length - offset : chunkSize;
+		char header[OTP_FRAME_HEADER];
+		OTP_packHeader(header, opcode, 0, count, requestID);
+
+		// Hold the header back until the payload joins it
+		if (_sendMore(socketFD, header, OTP_FRAME_HEADER) < 0 || _sendFileRange(socketFD, fileDescriptor, offset, count) < 0) OTP_fatal("ERROR writing to socket");
+	}
+
+	return OTP_sendFrame(socketFD, opcode, OTP_FLAG_END, NULL, 0, requestID);
+}
+
+/*********************************************************************
+ * int OTP_recvFrame(int fileDescriptor, struct OTP_Frame* frame, char* payload, size_t capacity)
+ *  Receives one whole frame from the connection
+ * Arguments:
+ * 	int fileDescriptor - the file descriptor of the connection
+ *  struct OTP_Frame* frame - where the frame's header is stored
+ *  char* payload - where the frame's payload is stored
+ *  size_t capacity - the most payload bytes that fit, normally the
+ *  	agreed chunk size
+ * Returns:
+ * 	0 on success, -1 if the connection closed or the frame is not
+ *  valid for this protocol
+*********************************************************************/
+int OTP_recvFrame(int fileDescriptor, struct OTP_Frame* frame, char* payload, size_t capacity)
+{
+	char header[OTP_FRAME_HEADER];
+	if (OTP_recvExact(fileDescriptor, header, OTP_FRAME_HEADER) < 0) {return -1;}
+	if (OTP_unpackHeader(header, frame) < 0 || frame->length > capacity) {return -1;}
+
+	return OTP_recvExact(fileDescriptor, payload, frame->length);
+}
+
+/*********************************************************************
+ * int OTP_isSocketPath(const char* destination)
+ *  Tells a Unix socket path from a port number
+ * Arguments:
+ * 	const char* destination - a port number or a socket path
+ * Returns:
+ * 	1 if destination is a path, 0 if it is a port
+*********************************************************************/
+int OTP_isSocketPath(const char* destination)
+{
+	return destination[0] == '\0' || destination[strspn(destination, "0123456789")] != '\0';
+}
+
+/*********************************************************************
+ * int OTP_connectTo(const char* destination)
+ *  Connects to a daemon on this host, over TCP if destination is a
+ *  port number and over a Unix domain socket if it is a path
+ * Arguments:
+ * 	const char* destination - the daemon's port or socket path
+ * Returns:
+ * 	int - the connected socket
+*********************************************************************/
+int OTP_connectTo(const char* destination)
+{
+	int socketFD;
+
+	if (OTP_isSocketPath(destination))
+	{
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, destination, sizeof(address.sun_path) - 1);
+
+		socketFD = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (socketFD < 0) OTP_fatal("CLIENT: ERROR opening socket");
+		if (connect(socketFD, (struct sockaddr*) &address, sizeof(address)) < 0) OTP_fatal("CLIENT: ERROR connecting");
+		return socketFD;
+	}
+
+	struct sockaddr_in serverAddress;
+	memset(&serverAddress, 0, sizeof(serverAddress));
+	serverAddress.sin_family = AF_INET;
+	serverAddress.sin_port = htons(atoi(destination));
+	struct hostent* serverHostInfo = gethostbyname("localhost");
+	if (serverHostInfo == NULL) { fprintf(stderr, "CLIENT: ERROR, no such host\n"); exit(0); }
+	memcpy(&serverAddress.sin_addr.s_addr, serverHostInfo->h_addr_list[0], serverHostInfo->h_length);
+
+	socketFD = socket(AF_INET, SOCK_STREAM, 0);
+	if (socketFD < 0) OTP_fatal("CLIENT: ERROR opening socket");
+	if (connect(socketFD, (struct sockaddr*) &serverAddress, sizeof(serverAddress)) < 0) OTP_fatal("CLIENT: ERROR connecting");
+	int noDelay = 1; // Don't hold the small end-of-file frames back
+	setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	return socketFD;
+}
+
+/*********************************************************************
+ * int OTP_clientHello(int fileDescriptor, int decoding, int mode, size_t* chunkSize)
+ *  Asks the daemon for an operation and alphabet, and agrees on the
+ *  largest payload either side will send in one frame
+ * Arguments:
+ * 	int fileDescriptor - the file descriptor of the connection
+ *  int decoding - 0 to ask for encoding, 1 for decoding
+ *  int mode - the OTP_MODE alphabet
+ *  size_t* chunkSize - holds the proposed chunk size, and is set to the
+ *  	agreed one, or to the milliseconds to wait if the daemon is busy
+ * Returns:
+ * 	int - the daemon's status, 200 if accepted, OTP_BUSY if it has no
+ * 	room for the connection right now or reset it unanswered
+*********************************************************************/
+int OTP_clientHello(int fileDescriptor, int decoding, int mode, size_t* chunkSize)
+{
+	char payload[OTP_HELLO_SIZE] = {0};
+	struct OTP_Frame frame;
+
+	payload[0] = decoding;
+	payload[1] = mode;
+	_putUint32(payload + 4, *chunkSize);
+	OTP_sendFrame(fileDescriptor, OTP_OP_HELLO, 0, payload, OTP_HELLO_SIZE, 0);
+
+	// A busy daemon that closed before the hello came in resets the
+	// connection; anything else but a well formed welcome is a refusal
+	errno = 0;
+	if (OTP_recvFrame(fileDescriptor, &frame, payload, OTP_WELCOME_SIZE) < 0 || frame.opcode != OTP_OP_WELCOME || frame.length != OTP_WELCOME_SIZE)
+	{
+		if (errno == ECONNRESET) {*chunkSize = 0; return OTP_BUSY;}
+		return 403;
+	}
+	*chunkSize = _getUint32(payload + 4);
+	return _getUint16(payload);
+}
+
+/*********************************************************************
+ * int OTP_clientOpen(const char* destination, int decoding, int mode, size_t* chunkSize)
+ *  Connects to the daemon and says hello, trying again while it is
+ *  busy. Each wait is the longer of what the daemon asked for and a
+ *  backoff that doubles every attempt, jittered so that clients
+ *  turned away together don't all come back together.
+ * Arguments:
+ * 	const char* destination - the daemon's port or socket path
+ *  int decoding - 0 to ask for encoding, 1 for decoding
+ *  int mode - the OTP_MODE alphabet
+ *  size_t* chunkSize - holds the proposed chunk size, and is set to the
+ *  	agreed one
+ * Returns:
+ * 	int - the connected socket, or -1 if refused or still busy after
+ * 	OTP_RETRY_ATTEMPTS tries
+*********************************************************************/
+int OTP_clientOpen(const char* destination, int decoding, int mode, size_t* chunkSize)
+{
+	unsigned int seed = getpid() ^ time(NULL);
+	unsigned long backoff = OTP_RETRY_MIN;
+	int attempt;
+
+	for (attempt = 1; ; attempt++)
+	{
+		size_t agreed = *chunkSize;
+		int socketFD = OTP_connectTo(destination);
+		int status = OTP_clientHello(socketFD, decoding, mode, &agreed);
+		if (status == 200)
+		{
+			*chunkSize = agreed;
+			return socketFD;
+		}
+		close(socketFD);
+		if (status != OTP_BUSY || attempt == OTP_RETRY_ATTEMPTS) {return -1;}
+
+		// Wait somewhere between half and one and a half times as long
+		unsigned long wait = agreed > backoff ? agreed : backoff;
+		wait = wait / 2 + rand_r(&seed) % (wait + 1);
+		usleep(wait * 1000);
+		backoff = backoff * 2 < OTP_RETRY_MAX ? backoff * 2 : OTP_RETRY_MAX;
+	}
+}
+
+/*********************************************************************
+ * int OTP_requestStats(int socketFD, struct OTP_Buffer* text)
+ *  Asks the daemon for its metrics, on a connection that has not said
+ *  HELLO
+ * Arguments:
+ * 	int socketFD - the socket for the connection
+ *  struct OTP_Buffer* text - where the "name value" lines are appended
+ * Returns:
+ * 	0 on success, -1 if the daemon did not answer
+*********************************************************************/
+int OTP_requestStats(int socketFD, struct OTP_Buffer* text)
+{
+	struct OTP_Frame frame;
+	if (OTP_sendFrame(socketFD, OTP_OP_STATS, OTP_FLAG_END, NULL, 0, 1) < 0) {return -1;}
+
+	do
+	{
+		char* space = OTP_bufferReserve(text, OTP_CHUNK_MAX);
+		if (space == NULL || OTP_recvFrame(socketFD, &frame, space, OTP_CHUNK_MAX) < 0 || frame.opcode != OTP_OP_DATA) {return -1;}
+		text->length += frame.length;
+		text->data[text->length] = '\0';
+	} while (!(frame.flags & OTP_FLAG_END));
+
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_uploadKey(int socketFD, int fileDescriptor, size_t length, size_t chunkSize, unsigned long* keyID, size_t* badOffset)
+ *  Stores a key file in the daemon's key store, after the handshake
+ * Arguments:
+ * 	int socketFD - the socket for the connection
+ *  int fileDescriptor - the open key file, which is closed afterwards
+ *  size_t length - the number of bytes in the file
+ *  size_t chunkSize - the agreed chunk size
+ *  unsigned long* keyID - where the ID the key was stored under is stored
+ *  size_t* badOffset - where the offset of a refused byte is stored
+ * Returns:
+ * 	OTP_SUCCESS, or the OTP_ERR code the daemon refused the key with
+*********************************************************************/
+int OTP_uploadKey(int socketFD, int fileDescriptor, size_t length, size_t chunkSize, unsigned long* keyID, size_t* badOffset)
+{
+	char payload[OTP_KEYREF_SIZE > OTP_ERROR_SIZE ? OTP_KEYREF_SIZE : OTP_ERROR_SIZE];
+	struct OTP_Frame frame;
+
+	OTP_sendFileFrames(socketFD, OTP_OP_KEYPUT, fileDescriptor, length, chunkSize, 1);
+	close(fileDescriptor);
+
+	*badOffset = 0;
+	if (OTP_recvFrame(socketFD, &frame, payload, sizeof(payload)) < 0) {return OTP_ERR_FILE;}
+	if (frame.opcode == OTP_OP_ERROR) {return OTP_parseError(payload, frame.length, badOffset);}
+	if (frame.opcode != OTP_OP_KEYREF || OTP_parseKeyRef(payload, frame.length, keyID, badOffset) < 0) {return OTP_ERR_FILE;}
+
+	return OTP_SUCCESS;
+}
+
+/*********************************************************************
+ * int OTP_acceptHello(const char* payload, size_t length, int serves, size_t maxChunk, int* decoding, int* mode, size_t* chunkSize)
+ *  Decides on a client's hello, accepting it only if it asks for an
+ *  operation this daemon serves, a known alphabet and a usable chunk
+ *  size
+ * Arguments:
+ * 	const char* payload - the HELLO frame's payload
+ *  size_t length - the number of payload bytes
+ *  int serves - the OTP_SERVE operations this daemon accepts
+ *  size_t maxChunk - the largest chunk size this daemon will agree to
+ *  int* decoding - where the operation is stored, 1 for decoding
+ *  int* mode - where the agreed OTP_MODE alphabet is stored
+ *  size_t* chunkSize - where the agreed chunk size is stored
+ * Returns:
+ * 	int - the status for the WELCOME reply, 200 if accepted
+*********************************************************************/
+int OTP_acceptHello(const char* payload, size_t length, int serves, size_t maxChunk, int* decoding, int* mode, size_t* chunkSize)
+{
+	if (length != OTP_HELLO_SIZE) {return 403;}
+
+	*decoding = payload[0];
+	*mode = (unsigned char) payload[1];
+	*chunkSize = _getUint32(payload + 4);
+	if (*chunkSize > maxChunk) {*chunkSize = maxChunk;}
+
+	int served = (*decoding == 0 && (serves & OTP_SERVE_ENCODE)) || (*decoding == 1 && (serves & OTP_SERVE_DECODE));
+	return served && *mode < OTP_NUM_MODES && *chunkSize >= OTP_CHUNK_MIN ? 200 : 403;
+}
+
+/*********************************************************************
+ * void OTP_packWelcome(char payload[], int status, size_t chunkSize)
+ *  Writes the payload of a WELCOME frame
+ * Arguments:
+ * 	char payload[] - where the OTP_WELCOME_SIZE bytes are stored
+ *  int status - 200 if the hello was accepted, OTP_BUSY if there is
+ *  	no room for the connection
+ *  size_t chunkSize - the agreed chunk size, or for OTP_BUSY the
+ *  	milliseconds the client should wait before trying again
+*********************************************************************/
+void OTP_packWelcome(char payload[], int status, size_t chunkSize)
+{
+	memset(payload, 0, OTP_WELCOME_SIZE);
+	_putUint16(payload, status);
+	_putUint32(payload + 4, status == 200 || status == OTP_BUSY ? chunkSize : 0);
+}
+
+/*********************************************************************
+ * int OTP_serverHello(int fileDescriptor, int serves, int* decoding, int* mode, size_t* chunkSize)
+ *  Receives a client's hello and answers it
+ * Arguments:
+ * 	int fileDescriptor - the file descriptor of the connection
+ *  int serves - the OTP_SERVE operations this daemon accepts
+ *  int* decoding - where the operation is stored, 1 for decoding
+ *  int* mode - where the agreed OTP_MODE alphabet is stored
+ *  size_t* chunkSize - where the agreed chunk size is stored
+ * Returns:
+ * 	0 if accepted, -1 if refused
+*********************************************************************/
+int OTP_serverHello(int fileDescriptor, int serves, int* decoding, int* mode, size_t* chunkSize)
+{
+	char payload[OTP_HELLO_SIZE] = {0};
+	struct OTP_Frame frame;
+	int status = 403;
+
+	if (OTP_recvFrame(fileDescriptor, &frame, payload, OTP_HELLO_SIZE) == 0 && frame.opcode == OTP_OP_HELLO)
+	{
+		status = OTP_acceptHello(payload, frame.length, serves, OTP_CHUNK_MAX, decoding, mode, chunkSize);
+	}
+
+	OTP_packWelcome(payload, status, *chunkSize);
+	OTP_sendFrame(fileDescriptor, OTP_OP_WELCOME, 0, payload, OTP_WELCOME_SIZE, 0);
+
+	return status == 200 ? 0 : -1;
+}
+
+/*********************************************************************
+ * void OTP_packError(char payload[], int code, size_t offset)
+ *  Writes the payload of an ERROR frame
+ * Arguments:
+ * 	char payload[] - where the OTP_ERROR_SIZE bytes are stored
+ *  int code - the OTP_ERR code
+ *  size_t offset - the offset of the bad symbol
+*********************************************************************/
+void OTP_packError(char payload[], int code, size_t offset)
+{
+	_putUint32(payload, (unsigned long) (unsigned int) code);
+	_putUint32(payload + 4, (unsigned long long) offset >> 32);
+	_putUint32(payload + 8, offset & 0xFFFFFFFF);
+}
+
+/*********************************************************************
+ * int OTP_sendError(int fileDescriptor, int code, size_t offset, unsigned long requestID)
+ *  Tells the client its request failed, in place of the result
+ * Arguments:
+ * 	int fileDescriptor - the file descriptor of the connection
+ *  int code - the OTP_ERR code
+ *  size_t offset - the offset of the bad symbol
+ *  unsigned long requestID - the request that failed
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_sendError(int fileDescriptor, int code, size_t offset, unsigned long requestID)
+{
+	char payload[OTP_ERROR_SIZE];
+	OTP_packError(payload, code, offset);
+
+	return OTP_sendFrame(fileDescriptor, OTP_OP_ERROR, OTP_FLAG_END, payload, OTP_ERROR_SIZE, requestID);
+}
+
+/*********************************************************************
+ * int OTP_parseError(const char* payload, size_t length, size_t* offset)
+ *  Reads the payload of an ERROR frame
+ * Arguments:
+ * 	const char* payload - the frame's payload
+ *  size_t length - the number of payload bytes
+ *  size_t* offset - where the offset of the bad symbol is stored
+ * Returns:
+ * 	int - the OTP_ERR code
+*********************************************************************/
+int OTP_parseError(const char* payload, size_t length, size_t* offset)
+{
+	*offset = 0;
+	if (length < OTP_ERROR_SIZE) {return OTP_ERR_BADTEXT;}
+	*offset = (size_t) ((unsigned long long) _getUint32(payload + 4) << 32 | _getUint32(payload + 8));
+
+	return (int) (unsigned int) _getUint32(payload);
+}
+
+/*********************************************************************
+ * void OTP_packKeyRef(char payload[], unsigned long keyID, size_t offset)
+ *  Writes the payload of a KEYREF frame
+ * Arguments:
+ * 	char payload[] - where the OTP_KEYREF_SIZE bytes are stored
+ *  unsigned long keyID - the stored key
+ *  size_t offset - where in the key the pad starts, or OTP_KEY_NEXT
+*********************************************************************/
+void OTP_packKeyRef(char payload[], unsigned long keyID, size_t offset)
+{
+	_putUint32(payload, keyID);
+	_putUint32(payload + 4, 0);
+	_putUint32(payload + 8, (unsigned long long) offset >> 32);
+	_putUint32(payload + 12, offset & 0xFFFFFFFF);
+}
+
+/*********************************************************************
+ * int OTP_parseKeyRef(const char* payload, size_t length, unsigned long* keyID, size_t* offset)
+ *  Reads the payload of a KEYREF frame
+ * Arguments:
+ * 	const char* payload - the frame's payload
+ *  size_t length - the number of payload bytes
+ *  unsigned long* keyID - where the stored key's ID is stored
+ *  size_t* offset - where the pad's offset in the key is stored
+ * Returns:
+ * 	0 on success, -1 if the payload is too short
+*********************************************************************/
+int OTP_parseKeyRef(const char* payload, size_t length, unsigned long* keyID, size_t* offset)
+{
+	if (length < OTP_KEYREF_SIZE) {return -1;}
+	*keyID = _getUint32(payload);
+	*offset = (size_t) ((unsigned long long) _getUint32(payload + 8) << 32 | _getUint32(payload + 12));
+
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_parseKeyName(const char* name, unsigned long* keyID, size_t* offset)
+ *  Tells a stored key, named "@id" or "@id:offset" on the command
+ *  line, from a key file
+ * Arguments:
+ * 	const char* name - the key argument
+ *  unsigned long* keyID - where a stored key's ID is stored
+ *  size_t* offset - where its offset is stored, OTP_KEY_NEXT if none
+ * Returns:
+ * 	1 for a stored key, 0 for a key file, -1 if the name is malformed
+*********************************************************************/
+int OTP_parseKeyName(const char* name, unsigned long* keyID, size_t* offset)
+{
+	char* end;
+	if (name[0] != '@') {return 0;}
+
+	*keyID = strtoul(name + 1, &end, 10);
+	*offset = OTP_KEY_NEXT;
+	if (end == name + 1 || *keyID == 0 || *keyID > 0xFFFFFFFFUL) {return -1;}
+	if (*end == ':')
+	{
+		const char* digits = end + 1;
+		*offset = strtoull(digits, &end, 10);
+		if (end == digits || *offset == OTP_KEY_NEXT) {return -1;}
+	}
+	return *end == '\0' ? 1 : -1;
+}
+
+/*********************************************************************
+ * int getCharVal(char character)
+ *  Gets the numerical value of a character
+ * Arguments:
+ * 	char character - the character to translate
+ * Returns:
+ * 	int - the int value of the character
+ *  -1 if failed
+*********************************************************************/
+int getCharVal(char character)
+{
+    if (character >= 'A' && character <= 'Z')
+    {
+        return character - 'A';
+    }
+    else if (character == ' ')
+    {
+        return 26;
+    }
+    else
+    {
+        fprintf(stderr, "ERROR invalid character '%c' detected\n", character);
+        exit(1);
+    }
+    return -1;
+}
+
+/*********************************************************************
+ * char getIntChar(int value)
+ *  Gets character of the integer value
+ * Arguments:
+ * 	int value - the integer to translate
+ * Returns:
+ * 	char - the character of the int value
+ *  -1 if failed
+*********************************************************************/
+char getIntChar(int value)
+{
+    if (value == OTP_NUMCHARS - 1) {return ' ';}
+    else if (value < OTP_NUMCHARS) {return (char) value + 'A';}
+    else
+    {
+        fprintf(stderr, "ERROR invalid value '%d' detected\n", value);
+        exit(1);
+    }
+    return -1;
+}
+
+// Lookup tables for the 27-symbol scalar kernels. symbolValues maps every
+// byte to its symbol value, or -1 if it is not in the alphabet. The result
+// tables hold the finished character for every pair of symbol values.
+static signed char symbolValues[256];
+static char encodeTable[OTP_NUMCHARS][OTP_NUMCHARS];
+static char decodeTable[OTP_NUMCHARS][OTP_NUMCHARS];
+
+/*********************************************************************
+ * static void _buildTables(void)
+ *  Fills the scalar lookup tables. Runs once at program start.
+*********************************************************************/
+__attribute__((constructor))
+static void _buildTables(void)
+{
+    int character, message, pad;
+    for (character = 0; character < 256; character++)
+    {
+        symbolValues[character] = -1;
+    }
+    for (character = 'A'; character <= 'Z'; character++)
+    {
+        symbolValues[character] = character - 'A';
+    }
+    symbolValues[' '] = OTP_NUMCHARS - 1;
+
+    for (message = 0; message < OTP_NUMCHARS; message++)
+    {
+        for (pad = 0; pad < OTP_NUMCHARS; pad++)
+        {
+            encodeTable[message][pad] = getIntChar((message + pad) % OTP_NUMCHARS);
+            decodeTable[message][pad] = getIntChar((message - pad + OTP_NUMCHARS) % OTP_NUMCHARS);
+        }
+    }
+}
+
+/*
+ * Alphabets. Every kernel below takes the mode as a constant and is
+ * forced inline into a small wrapper per mode, so the compiler builds a
+ * separate specialized loop for each alphabet:
+ *  OTP_MODE_ALPHA27 - 'A'-'Z' and ' ', added modulo 27
+ *  OTP_MODE_PRINTABLE - ' ' through '~', added modulo 95
+ *  OTP_MODE_RAW - any byte, XORed with the key (needs no validation)
+ */
+#define OTP_INLINE static inline __attribute__((always_inline))
+
+/*********************************************************************
+ * static int _symbolValue(int mode, int character)
+ *  Gets the value of a character in an alphabet
+ * Arguments:
+ * 	int mode - the OTP_MODE alphabet
+ *  int character - the character to translate
+ * Returns:
+ * 	int - the value of the character, or -1 if it is not in the alphabet
+*********************************************************************/
+OTP_INLINE int _symbolValue(int mode, int character)
+{
+    unsigned char byte = (unsigned char) character;
+    switch (mode)
+    {
+        case OTP_MODE_PRINTABLE: return byte - ' ' < OTP_PRINTABLE_CHARS ? byte - ' ' : -1;
+        case OTP_MODE_RAW: return byte;
+        default: return symbolValues[byte];
+    }
+}
+
+// Exported copy of _symbolValue for the clients' file checks
+int OTP_symbolValue(int mode, int character) { return _symbolValue(mode, character); }
+
+/*********************************************************************
+ * static size_t _scalarKernel(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
+ *  Validates and transforms one symbol at a time in a single pass
+ * Returns:
+ * 	size_t - the number of symbols transformed, which is the offset of
+ *  the first invalid symbol if it is less than length
+*********************************************************************/
+OTP_INLINE size_t _scalarKernel(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
+{
+    size_t index;
+    if (mode == OTP_MODE_RAW)
+    {
+        for (index = 0; index < length; index++)
+        {
+            output[index] = input[index] ^ key[index];
+        }
+        return length;
+    }
+
+    for (index = 0; index < length; index++)
+    {
+        int message = _symbolValue(mode, input[index]);
+        int pad = _symbolValue(mode, key[index]);
+        if ((message | pad) < 0) {break;}
+        if (mode == OTP_MODE_ALPHA27)
+        {
+            output[index] = decoding ? decodeTable[message][pad] : encodeTable[message][pad];
+        }
+        else
+        {
+            int value = decoding ? message - pad : message + pad;
+            if (value < 0) {value += OTP_PRINTABLE_CHARS;}
+            if (value >= OTP_PRINTABLE_CHARS) {value -= OTP_PRINTABLE_CHARS;}
+            output[index] = (char) (value + ' ');
+        }
+    }
+    return index;
+}
+
+/*********************************************************************
+ * size_t OTP_encodeScalar(const char* input, const char* key, char* output, size_t length)
+ *  Validates and encodes 27-symbol text one symbol at a time in a
+ *  single table-driven pass. This is the reference kernel every
+ *  vector kernel must match, and it finishes whatever tail a vector
+ *  kernel leaves behind.
+ * Arguments:
+ * 	const char* input - the plaintext symbols
+ *  const char* key - the key symbols
+ *  char* output - where the ciphertext symbols are stored
+ *  size_t length - the number of symbols to encode
+ * Returns:
+ * 	size_t - the number of symbols encoded, which is the offset of the
+ *  first invalid symbol if it is less than length
+*********************************************************************/
+size_t OTP_encodeScalar(const char* input, const char* key, char* output, size_t length)
+{
+    return _scalarKernel(OTP_MODE_ALPHA27, 0, input, key, output, length);
+}
+
+/*********************************************************************
+ * size_t OTP_decodeScalar(const char* input, const char* key, char* output, size_t length)
+ *  Validates and decodes 27-symbol text one symbol at a time. See
+ *  OTP_encodeScalar.
+ * Arguments:
+ * 	const char* input - the ciphertext symbols
+ *  const char* key - the key symbols
+ *  char* output - where the plaintext symbols are stored
+ *  size_t length - the number of symbols to decode
+ * Returns:
+ * 	size_t - the number of symbols decoded, which is the offset of the
+ *  first invalid symbol if it is less than length
+*********************************************************************/
+size_t OTP_decodeScalar(const char* input, const char* key, char* output, size_t length)
+{
+    return _scalarKernel(OTP_MODE_ALPHA27, 1, input, key, output, length);
+}
+
+static size_t _encodeScalarPrintable(const char* input, const char* key, char* output, size_t length) { return _scalarKernel(OTP_MODE_PRINTABLE, 0, input, key, output, length); }
+static size_t _decodeScalarPrintable(const char* input, const char* key, char* output, size_t length) { return _scalarKernel(OTP_MODE_PRINTABLE, 1, input, key, output, length); }
+static size_t _xorScalar(const char* input, const char* key, char* output, size_t length) { return _scalarKernel(OTP_MODE_RAW, 0, input, key, output, length); }
+
+/*********************************************************************
+ * static size_t _scanScalar(int mode, const char* data, size_t length)
+ *  Checks that every byte is in the alphabet, bar a newline as the
+ *  very last byte, the way the clients check their files
+ * Returns:
+ * 	size_t - the offset of the first bad byte, or length if none
+*********************************************************************/
+OTP_INLINE size_t _scanScalar(int mode, const char* data, size_t length)
+{
+    size_t index;
+    if (mode == OTP_MODE_RAW) {return length;}
+    for (index = 0; index < length; index++)
+    {
+        if (_symbolValue(mode, data[index]) < 0 && (data[index] != '\n' || index + 1 < length)) {break;}
+    }
+    return index;
+}
+
+static size_t _scanScalar27(const char* data, size_t length) { return _scanScalar(OTP_MODE_ALPHA27, data, length); }
+static size_t _scanScalarPrintable(const char* data, size_t length) { return _scanScalar(OTP_MODE_PRINTABLE, data, length); }
+static size_t _scanRaw(const char* data, size_t length) { (void) data; return length; }
+
+static int _alwaysSupported(void) { return 1; }
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Vector kernels. Each lane maps the alphabet onto 0..n-1, then reduces
+ * the sum (or difference) back into range with an unsigned min against
+ * the value shifted by n, which avoids both the branch and the modulo.
+ * A block holding any character outside the alphabet stops the kernel,
+ * and the scalar kernel then pins down the exact offset.
+ */
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+OTP_INLINE __m128i _valuesSSE2(int mode, __m128i chars, int* valid)
+{
+    __m128i values = _mm_sub_epi8(chars, _mm_set1_epi8(mode == OTP_MODE_ALPHA27 ? 'A' : ' '));
+    __m128i last = _mm_set1_epi8(mode == OTP_MODE_ALPHA27 ? 25 : OTP_PRINTABLE_CHARS - 1);
+    __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(values, last), values);
+    if (mode == OTP_MODE_PRINTABLE)
+    {
+        *valid = _mm_movemask_epi8(inRange) == 0xFFFF;
+        return values;
+    }
+    __m128i isSpace = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+    *valid = _mm_movemask_epi8(_mm_or_si128(inRange, isSpace)) == 0xFFFF;
+    return _mm_or_si128(_mm_and_si128(inRange, values), _mm_and_si128(isSpace, _mm_set1_epi8(26)));
+}
+
+__attribute__((target("sse2")))
+OTP_INLINE __m128i _charsSSE2(int mode, __m128i values)
+{
+    if (mode == OTP_MODE_PRINTABLE) {return _mm_add_epi8(values, _mm_set1_epi8(' '));}
+    __m128i isSpace = _mm_cmpeq_epi8(values, _mm_set1_epi8(26));
+    __m128i letters = _mm_add_epi8(values, _mm_set1_epi8('A'));
+    return _mm_or_si128(_mm_andnot_si128(isSpace, letters), _mm_and_si128(isSpace, _mm_set1_epi8(' ')));
+}
+
+__attribute__((target("sse2")))
+OTP_INLINE size_t _kernelSSE2(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
+{
+    __m128i size = _mm_set1_epi8((char) (mode == OTP_MODE_ALPHA27 ? OTP_NUMCHARS : OTP_PRINTABLE_CHARS));
+    size_t index;
+    for (index = 0; index + 16 <= length; index += 16)
+    {
+        __m128i message = _mm_loadu_si128((const __m128i*) (input + index));
+        __m128i pad = _mm_loadu_si128((const __m128i*) (key + index));
+        if (mode == OTP_MODE_RAW)
+        {
+            _mm_storeu_si128((__m128i*) (output + index), _mm_xor_si128(message, pad));
+            continue;
+        }
+
+        int inputValid, keyValid;
+        message = _valuesSSE2(mode, message, &inputValid);
+        pad = _valuesSSE2(mode, pad, &keyValid);
+        if (!inputValid || !keyValid) {break;}
+        __m128i value;
+        if (decoding)
+        {
+            value = _mm_sub_epi8(message, pad);
+            value = _mm_min_epu8(value, _mm_add_epi8(value, size));
+        }
+        else
+        {
+            value = _mm_add_epi8(message, pad);
+            value = _mm_min_epu8(value, _mm_sub_epi8(value, size));
+        }
+        _mm_storeu_si128((__m128i*) (output + index), _charsSSE2(mode, value));
+    }
+    return index;
+}
+
+__attribute__((target("avx2")))
+OTP_INLINE __m256i _valuesAVX2(int mode, __m256i chars, int* valid)
+{
+    __m256i values = _mm256_sub_epi8(chars, _mm256_set1_epi8(mode == OTP_MODE_ALPHA27 ? 'A' : ' '));
+    __m256i last = _mm256_set1_epi8(mode == OTP_MODE_ALPHA27 ? 25 : OTP_PRINTABLE_CHARS - 1);
+    __m256i inRange = _mm256_cmpeq_epi8(_mm256_min_epu8(values, last), values);
+    if (mode == OTP_MODE_PRINTABLE)
+    {
+        *valid = _mm256_movemask_epi8(inRange) == -1;
+        return values;
+    }
+    __m256i isSpace = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' '));
+    *valid = _mm256_movemask_epi8(_mm256_or_si256(inRange, isSpace)) == -1;
+    return _mm256_blendv_epi8(_mm256_and_si256(inRange, values), _mm256_set1_epi8(26), isSpace);
+}
+
+__attribute__((target("avx2")))
+OTP_INLINE __m256i _charsAVX2(int mode, __m256i values)
+{
+    if (mode == OTP_MODE_PRINTABLE) {return _mm256_add_epi8(values, _mm256_set1_epi8(' '));}
+    __m256i isSpace = _mm256_cmpeq_epi8(values, _mm256_set1_epi8(26));
+    return _mm256_blendv_epi8(_mm256_add_epi8(values, _mm256_set1_epi8('A')), _mm256_set1_epi8(' '), isSpace);
+}
+
+__attribute__((target("avx2")))
+OTP_INLINE size_t _kernelAVX2(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
+{
+    __m256i size = _mm256_set1_epi8((char) (mode == OTP_MODE_ALPHA27 ? OTP_NUMCHARS : OTP_PRINTABLE_CHARS));
+    size_t index;
+    for (index = 0; index + 32 <= length; index += 32)
+    {
+        __m256i message = _mm256_loadu_si256((const __m256i*) (input + index));
+        __m256i pad = _mm256_loadu_si256((const __m256i*) (key + index));
+        if (mode == OTP_MODE_RAW)
+        {
+            _mm256_storeu_si256((__m256i*) (output + index), _mm256_xor_si256(message, pad));
+            continue;
+        }
+
+        int inputValid, keyValid;
+        message = _valuesAVX2(mode, message, &inputValid);
+        pad = _valuesAVX2(mode, pad, &keyValid);
+        if (!inputValid || !keyValid) {break;}
+        __m256i value;
+        if (decoding)
+        {
+            value = _mm256_sub_epi8(message, pad);
+            value = _mm256_min_epu8(value, _mm256_add_epi8(value, size));
+        }
+        else
+        {
+            value = _mm256_add_epi8(message, pad);
+            value = _mm256_min_epu8(value, _mm256_sub_epi8(value, size));
+        }
+        _mm256_storeu_si256((__m256i*) (output + index), _charsAVX2(mode, value));
+    }
+    return index + _kernelSSE2(mode, decoding, input + index, key + index, output + index, length - index);
+}
+
+__attribute__((target("avx512bw")))
+OTP_INLINE __m512i _valuesAVX512(int mode, __m512i chars, int* valid)
+{
+    __m512i values = _mm512_sub_epi8(chars, _mm512_set1_epi8(mode == OTP_MODE_ALPHA27 ? 'A' : ' '));
+    __mmask64 inRange = _mm512_cmple_epu8_mask(values, _mm512_set1_epi8(mode == OTP_MODE_ALPHA27 ? 25 : OTP_PRINTABLE_CHARS - 1));
+    if (mode == OTP_MODE_PRINTABLE)
+    {
+        *valid = inRange == ~(__mmask64) 0;
+        return values;
+    }
+    __mmask64 isSpace = _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8(' '));
+    *valid = (inRange | isSpace) == ~(__mmask64) 0;
+    return _mm512_mask_blend_epi8(isSpace, values, _mm512_set1_epi8(26));
+}
+
+__attribute__((target("avx512bw")))
+OTP_INLINE __m512i _charsAVX512(int mode, __m512i values)
+{
+    if (mode == OTP_MODE_PRINTABLE) {return _mm512_add_epi8(values, _mm512_set1_epi8(' '));}
+    __mmask64 isSpace = _mm512_cmpeq_epi8_mask(values, _mm512_set1_epi8(26));
+    return _mm512_mask_blend_epi8(isSpace, _mm512_add_epi8(values, _mm512_set1_epi8('A')), _mm512_set1_epi8(' '));
+}
+
+__attribute__((target("avx512bw")))
+OTP_INLINE size_t _kernelAVX512(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
+{
+    __m512i size = _mm512_set1_epi8((char) (mode == OTP_MODE_ALPHA27 ? OTP_NUMCHARS : OTP_PRINTABLE_CHARS));
+    size_t index;
+    for (index = 0; index + 64 <= length; index += 64)
+    {
+        __m512i message = _mm512_loadu_si512(input + index);
+        __m512i pad = _mm512_loadu_si512(key + index);
+        if (mode == OTP_MODE_RAW)
+        {
+            _mm512_storeu_si512(output + index, _mm512_xor_si512(message, pad));
+            continue;
+        }
+
+        int inputValid, keyValid;
+        message = _valuesAVX512(mode, message, &inputValid);
+        pad = _valuesAVX512(mode, pad, &keyValid);
+        if (!inputValid || !keyValid) {break;}
+        __m512i value;
+        if (decoding)
+        {
+            value = _mm512_sub_epi8(message, pad);
+            value = _mm512_min_epu8(value, _mm512_add_epi8(value, size));
+        }
+        else
+        {
+            value = _mm512_add_epi8(message, pad);
+            value = _mm512_min_epu8(value, _mm512_sub_epi8(value, size));
+        }
+        _mm512_storeu_si512(output + index, _charsAVX512(mode, value));
+    }
+    return index + _kernelSSE2(mode, decoding, input + index, key + index, output + index, length - index);
+}
+
+// File scans: the same range checks. A block holding the trailing newline
+// fails them and is left to the scalar tail.
+__attribute__((target("sse2")))
+OTP_INLINE size_t _scanSSE2(int mode, const char* data, size_t length)
+{
+    size_t index;
+    for (index = 0; index + 16 <= length; index += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*) (data + index));
+        __m128i values = _mm_sub_epi8(chars, _mm_set1_epi8(mode == OTP_MODE_ALPHA27 ? 'A' : ' '));
+        __m128i last = _mm_set1_epi8(mode == OTP_MODE_ALPHA27 ? 25 : OTP_PRINTABLE_CHARS - 1);
+        __m128i valid = _mm_cmpeq_epi8(_mm_min_epu8(values, last), values);
+        if (mode == OTP_MODE_ALPHA27) {valid = _mm_or_si128(valid, _mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')));}
+        if (_mm_movemask_epi8(valid) != 0xFFFF) {break;}
+    }
+    return index;
+}
+
+__attribute__((target("avx2")))
+OTP_INLINE size_t _scanAVX2(int mode, const char* data, size_t length)
+{
+    size_t index;
+    for (index = 0; index + 32 <= length; index += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*) (data + index));
+        __m256i values = _mm256_sub_epi8(chars, _mm256_set1_epi8(mode == OTP_MODE_ALPHA27 ? 'A' : ' '));
+        __m256i last = _mm256_set1_epi8(mode == OTP_MODE_ALPHA27 ? 25 : OTP_PRINTABLE_CHARS - 1);
+        __m256i valid = _mm256_cmpeq_epi8(_mm256_min_epu8(values, last), values);
+        if (mode == OTP_MODE_ALPHA27) {valid = _mm256_or_si256(valid, _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' ')));}
+        if (_mm256_movemask_epi8(valid) != -1) {break;}
+    }
+    return index + _scanSSE2(mode, data + index, length - index);
+}
+
+__attribute__((target("avx512bw")))
+OTP_INLINE size_t _scanAVX512(int mode, const char* data, size_t length)
+{
+    size_t index;
+    for (index = 0; index + 64 <= length; index += 64)
+    {
+        __m512i chars = _mm512_loadu_si512(data + index);
+        __m512i values = _mm512_sub_epi8(chars, _mm512_set1_epi8(mode == OTP_MODE_ALPHA27 ? 'A' : ' '));
+        __mmask64 valid = _mm512_cmple_epu8_mask(values, _mm512_set1_epi8(mode == OTP_MODE_ALPHA27 ? 25 : OTP_PRINTABLE_CHARS - 1));
+        if (mode == OTP_MODE_ALPHA27) {valid |= _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8(' '));}
+        if (valid != ~(__mmask64) 0) {break;}
+    }
+    return index + _scanSSE2(mode, data + index, length - index);
+}
+
+__attribute__((target("sse2"))) static size_t _scanSSE2_27(const char* data, size_t length) { return _scanSSE2(OTP_MODE_ALPHA27, data, length); }
+__attribute__((target("sse2"))) static size_t _scanSSE2Printable(const char* data, size_t length) { return _scanSSE2(OTP_MODE_PRINTABLE, data, length); }
+__attribute__((target("avx2"))) static size_t _scanAVX2_27(const char* data, size_t length) { return _scanAVX2(OTP_MODE_ALPHA27, data, length); }
+__attribute__((target("avx2"))) static size_t _scanAVX2Printable(const char* data, size_t length) { return _scanAVX2(OTP_MODE_PRINTABLE, data, length); }
+__attribute__((target("avx512bw"))) static size_t _scanAVX512_27(const char* data, size_t length) { return _scanAVX512(OTP_MODE_ALPHA27, data, length); }
+__attribute__((target("avx512bw"))) static size_t _scanAVX512Printable(const char* data, size_t length) { return _scanAVX512(OTP_MODE_PRINTABLE, data, length); }
+
+// One specialized entry point per instruction set, alphabet and direction
+__attribute__((target("sse2"))) static size_t _encodeSSE2(const char* input, const char* key, char* output, size_t length) { return _kernelSSE2(OTP_MODE_ALPHA27, 0, input, key, output, length); }
+__attribute__((target("sse2"))) static size_t _decodeSSE2(const char* input, const char* key, char* output, size_t length) { return _kernelSSE2(OTP_MODE_ALPHA27, 1, input, key, output, length); }
+__attribute__((target("sse2"))) static size_t _encodeSSE2Printable(const char* input, const char* key, char* output, size_t length) { return _kernelSSE2(OTP_MODE_PRINTABLE, 0, input, key, output, length); }
+__attribute__((target("sse2"))) static size_t _decodeSSE2Printable(const char* input, const char* key, char* output, size_t length) { return _kernelSSE2(OTP_MODE_PRINTABLE, 1, input, key, output, length); }
+__attribute__((target("sse2"))) static size_t _xorSSE2(const char* input, const char* key, char* output, size_t length) { return _kernelSSE2(OTP_MODE_RAW, 0, input, key, output, length); }
+__attribute__((target("avx2"))) static size_t _encodeAVX2(const char* input, const char* key, char* output, size_t length) { return _kernelAVX2(OTP_MODE_ALPHA27, 0, input, key, output, length); }
+__attribute__((target("avx2"))) static size_t _decodeAVX2(const char* input, const char* key, char* output, size_t length) { return _kernelAVX2(OTP_MODE_ALPHA27, 1, input, key, output, length); }
+__attribute__((target("avx2"))) static size_t _encodeAVX2Printable(const char* input, const char* key, char* output, size_t length) { return _kernelAVX2(OTP_MODE_PRINTABLE, 0, input, key, output, length); }
+__attribute__((target("avx2"))) static size_t _decodeAVX2Printable(const char* input, const char* key, char* output, size_t length) { return _kernelAVX2(OTP_MODE_PRINTABLE, 1, input, key, output, length); }
+__attribute__((target("avx2"))) static size_t _xorAVX2(const char* input, const char* key, char* output, size_t length) { return _kernelAVX2(OTP_MODE_RAW, 0, input, key, output, length); }
+__attribute__((target("avx512bw"))) static size_t _encodeAVX512(const char* input, const char* key, char* output, size_t length) { return _kernelAVX512(OTP_MODE_ALPHA27, 0, input, key, output, length); }
+__attribute__((target("avx512bw"))) static size_t _decodeAVX512(const char* input, const char* key, char* output, size_t length) { return _kernelAVX512(OTP_MODE_ALPHA27, 1, input, key, output, length); }
+__attribute__((target("avx512bw"))) static size_t _encodeAVX512Printable(const char* input, const char* key, char* output, size_t length) { return _kernelAVX512(OTP_MODE_PRINTABLE, 0, input, key, output, length); }
+__attribute__((target("avx512bw"))) static size_t _decodeAVX512Printable(const char* input, const char* key, char* output, size_t length) { return _kernelAVX512(OTP_MODE_PRINTABLE, 1, input, key, output, length); }
+__attribute__((target("avx512bw"))) static size_t _xorAVX512(const char* input, const char* key, char* output, size_t length) { return _kernelAVX512(OTP_MODE_RAW, 0, input, key, output, length); }
+
+static int _supportsSSE2(void) { return __builtin_cpu_supports("sse2"); }
+static int _supportsAVX2(void) { return __builtin_cpu_supports("avx2"); }
+static int _supportsAVX512(void) { return __builtin_cpu_supports("avx512bw"); }
+#endif
+
+// Every kernel, grouped by alphabet in order of preference. The scalar
+// kernel is always last in its group.
+static const struct OTP_Kernel kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", OTP_MODE_ALPHA27, _encodeAVX512, _decodeAVX512, _scanAVX512_27, _supportsAVX512},
+    {"avx2", OTP_MODE_ALPHA27, _encodeAVX2, _decodeAVX2, _scanAVX2_27, _supportsAVX2},
+    {"sse2", OTP_MODE_ALPHA27, _encodeSSE2, _decodeSSE2, _scanSSE2_27, _supportsSSE2},
+#endif
+    {"scalar", OTP_MODE_ALPHA27, OTP_encodeScalar, OTP_decodeScalar, _scanScalar27, _alwaysSupported},
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", OTP_MODE_PRINTABLE, _encodeAVX512Printable, _decodeAVX512Printable, _scanAVX512Printable, _supportsAVX512},
+    {"avx2", OTP_MODE_PRINTABLE, _encodeAVX2Printable, _decodeAVX2Printable, _scanAVX2Printable, _supportsAVX2},
+    {"sse2", OTP_MODE_PRINTABLE, _encodeSSE2Printable, _decodeSSE2Printable, _scanSSE2Printable, _supportsSSE2},
+#endif
+    {"scalar", OTP_MODE_PRINTABLE, _encodeScalarPrintable, _decodeScalarPrintable, _scanScalarPrintable, _alwaysSupported},
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", OTP_MODE_RAW, _xorAVX512, _xorAVX512, _scanRaw, _supportsAVX512},
+    {"avx2", OTP_MODE_RAW, _xorAVX2, _xorAVX2, _scanRaw, _supportsAVX2},
+    {"sse2", OTP_MODE_RAW, _xorSSE2, _xorSSE2, _scanRaw, _supportsSSE2},
+#endif
+    {"scalar", OTP_MODE_RAW, _xorScalar, _xorScalar, _scanRaw, _alwaysSupported}
+};
+static const struct OTP_Kernel* selectedKernels[OTP_NUM_MODES];
+
+/*********************************************************************
+ * const struct OTP_Kernel* OTP_getKernels(int* count)
+ *  Lists every kernel compiled into the program, supported or not.
+ * Arguments:
+ * 	int* count - where the number of kernels is stored
+ * Returns:
+ * 	const struct OTP_Kernel* - the array of kernels
+*********************************************************************/
+const struct OTP_Kernel* OTP_getKernels(int* count)
+{
+    *count = sizeof(kernels) / sizeof(kernels[0]);
+    return kernels;
+}
+
+/*********************************************************************
+ * static const struct OTP_Kernel* _scalarKernelFor(int mode)
+ *  Gets the scalar kernel of an alphabet
+*********************************************************************/
+static const struct OTP_Kernel* _scalarKernelFor(int mode)
+{
+    int count, index;
+    OTP_getKernels(&count);
+    for (index = 0; index < count; index++)
+    {
+        if (kernels[index].mode == mode && kernels[index].supported == _alwaysSupported) {break;}
+    }
+    return &kernels[index];
+}
+
+/*********************************************************************
+ * const struct OTP_Kernel* OTP_selectKernel(int mode)
+ *  Picks the fastest kernel this CPU supports for an alphabet the
+ *  first time it is called. The OTP_KERNEL environment variable can
+ *  name a kernel to use instead (e.g. OTP_KERNEL=scalar).
+ * Arguments:
+ * 	int mode - the OTP_MODE alphabet
+ * Returns:
+ * 	const struct OTP_Kernel* - the kernel the codec uses
+*********************************************************************/
+const struct OTP_Kernel* OTP_selectKernel(int mode)
+{
+    if (selectedKernels[mode] != NULL) {return selectedKernels[mode];}
+
+    char* requested = getenv("OTP_KERNEL");
+    int count, index;
+    OTP_getKernels(&count);
+    for (index = 0; index < count; index++)
+    {
+        if (kernels[index].mode != mode || !kernels[index].supported()) {continue;}
+        if (requested == NULL || !strcmp(requested, kernels[index].name))
+        {
+            selectedKernels[mode] = &kernels[index];
+            return selectedKernels[mode];
+        }
+    }
+    // Requested kernel is unknown or unsupported, fall back on scalar
+    selectedKernels[mode] = _scalarKernelFor(mode);
+    return selectedKernels[mode];
+}
+
+/*********************************************************************
+ * int OTP_parseMode(const char* name)
+ *  Gets the alphabet mode with the given name
+ * Arguments:
+ * 	const char* name - "alpha27", "printable" or "raw"
+ * Returns:
+ * 	int - the OTP_MODE value, or -1 if the name is unknown
+*********************************************************************/
+int OTP_parseMode(const char* name)
+{
+    int mode;
+    for (mode = 0; mode < OTP_NUM_MODES; mode++)
+    {
+        if (!strcasecmp(name, OTP_modeName(mode))) {return mode;}
+    }
+    return -1;
+}
+
+/*********************************************************************
+ * const char* OTP_modeName(int mode)
+ *  Gets the name of an alphabet mode
+ * Arguments:
+ * 	int mode - the OTP_MODE value
+ * Returns:
+ * 	const char* - the name of the mode
+*********************************************************************/
+const char* OTP_modeName(int mode)
+{
+    switch (mode)
+    {
+        case OTP_MODE_ALPHA27: return "alpha27";
+        case OTP_MODE_PRINTABLE: return "printable";
+        case OTP_MODE_RAW: return "raw";
+        default: return "unknown";
+    }
+}
 
 /*********************************************************************
- * int checkSent(int socketFD)
- *  Verifies the message has been sent.
+ * size_t OTP_validateBuffer(int mode, const char* data, size_t length)
+ *  Checks that a buffer only holds symbols of the alphabet and
+ *  newlines, using the fastest scan this CPU supports
  * Arguments:
- * 	int socketFD - the file descriptor of the connection.
+ * 	int mode - the OTP_MODE alphabet
+ *  const char* data - the bytes to check
+ *  size_t length - the number of bytes to check
  * Returns:
- * 	0 on success.
+ * 	size_t - the offset of the first bad byte, or length if none
 *********************************************************************/
-int checkSent(int socketFD)
+size_t OTP_validateBuffer(int mode, const char* data, size_t length)
 {
-	int checkSend = 5;
-	do
-	{
-		ioctl(socketFD, TIOCOUTQ, &checkSend);
-	} while (checkSend > 0);
-	if (checkSend < 0)
-	{
-		error("ioctl error");
-	}
-
-    return 0;
+    size_t done = OTP_selectKernel(mode)->validate(data, length);
+    return done + _scalarKernelFor(mode)->validate(data + done, length - done);
 }
 
 /*********************************************************************
- * int sendMessage(char* source, char* message, int fileDescriptor)
- *  Sends a message to the connection.
+ * int OTP_validateFd(int fileDescriptor, int mode, size_t* length, size_t* badOffset)
+ *  Maps an open file into memory and checks it in a single pass at
+ *  memory speed, in place of reading it a character at a time. The
+ *  descriptor is left open, and its pages cached, for uploading.
  * Arguments:
- * 	char* source - Whether the server or client is sending the message.
- *  char* message - the message to send.
- *  int fileDescriptor - the file descriptor of the connection.
+ * 	int fileDescriptor - the open file
+ *  int mode - the OTP_MODE alphabet the file must use
+ *  size_t* length - where the number of bytes in the file is stored
+ *  size_t* badOffset - where the offset of the first bad byte is stored
  * Returns:
- * 	0 on success.
+ * 	OTP_SUCCESS, OTP_ERR_BADTEXT if the file holds a bad byte, or
+ *  OTP_ERR_FILE if the file could not be read
 *********************************************************************/
-int sendMessage(char* source, char* message, int fileDescriptor)
+int OTP_validateFd(int fileDescriptor, int mode, size_t* length, size_t* badOffset)
 {
-	int charsWritten;
+    struct stat fileInfo;
+    if (fstat(fileDescriptor, &fileInfo) < 0) {return OTP_ERR_FILE;}
 
-	// printf("%s: I sent this to the client \"%s\" %ld\n", source, message, strlen(message));
-	charsWritten = send(fileDescriptor, message, strlen(message), 0); // Write to the server
-	if (charsWritten < 0) { fprintf(stderr, "%s", source); error(": ERROR writing to socket"); }
-	if (charsWritten < strlen(message)) printf("%s: WARNING: Not all data written to socket!\n", source);
-	checkSent(fileDescriptor);
-	
-	return 0;
+    *length = fileInfo.st_size;
+    *badOffset = *length;
+    // Raw files need no scan, and empty files can't be mapped
+    if (mode != OTP_MODE_RAW && *length > 0)
+    {
+        char* data = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (data == MAP_FAILED) {return OTP_ERR_FILE;}
+        madvise(data, *length, MADV_SEQUENTIAL);
+        *badOffset = OTP_validateBuffer(mode, data, *length);
+        munmap(data, *length);
+    }
+
+    return *badOffset < *length ? OTP_ERR_BADTEXT : OTP_SUCCESS;
 }
 
 /*********************************************************************
- * int getResponse(char* source, char buffer[], int fileDescriptor)
- *  Recieves a message from a connection
+ * int OTP_validateFile(const char* fileName, int mode, size_t* length, size_t* badOffset)
+ *  Opens a file and checks it as OTP_validateFd does
  * Arguments:
- * 	char* source - Whether the server or client is sending the message.
- *  char* buffer[] - The location to hold the recieves message
- *  int fileDescriptor - the file descriptor of the connection.
+ * 	const char* fileName - the name of the file
+ *  int mode - the OTP_MODE alphabet the file must use
+ *  size_t* length - where the number of bytes in the file is stored
+ *  size_t* badOffset - where the offset of the first bad byte is stored
  * Returns:
- * 	0 on success.
+ * 	OTP_SUCCESS, OTP_ERR_BADTEXT if the file holds a bad byte, or
+ *  OTP_ERR_FILE if the file could not be read
 *********************************************************************/
-int getResponse(char* source, char buffer[], int fileDescriptor)
+int OTP_validateFile(const char* fileName, int mode, size_t* length, size_t* badOffset)
 {
-	int charsRead;
+    int fileDescriptor = open(fileName, O_RDONLY);
+    if (fileDescriptor < 0) {return OTP_ERR_FILE;}
+    int result = OTP_validateFd(fileDescriptor, mode, length, badOffset);
+    close(fileDescriptor);
 
-	memset(buffer, '\0', OTP_BUFFERSIZE); // Clear out the buffer again for reuse
-	charsRead = recv(fileDescriptor, buffer, OTP_BUFFERSIZE - 1, 0); // Read data from the socket, leaving \0 at end
-	if (charsRead < 0) { fprintf(stderr, "%s", source); error(": ERROR reading from socket"); }
-	// printf("%s: I received this from the server: \"%s\"\n", source, buffer); // DEBUGGING
+    return result;
+}
 
-	return 0;
+/*********************************************************************
+ * static size_t _kernelPass(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
+ *  Runs the selected kernel over a range, letting the scalar kernel
+ *  finish whatever the vector kernel leaves behind
+ * Returns:
+ * 	size_t - the number of symbols transformed, which is the offset of
+ *  the first invalid symbol if it is less than length
+*********************************************************************/
+static size_t _kernelPass(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
+{
+    const struct OTP_Kernel* kernel = OTP_selectKernel(mode);
+    OTP_kernelFunc vector = decoding ? kernel->decode : kernel->encode;
+    OTP_kernelFunc scalar = decoding ? _scalarKernelFor(mode)->decode : _scalarKernelFor(mode)->encode;
+
+    size_t done = vector(input, key, output, length);
+    return done + scalar(input + done, key + done, output + done, length - done);
 }
 
+/*
+ * Parallel codec. A fixed pool of worker threads is started the first
+ * time a large input is seen. The input is cut into cache-sized ranges
+ * that the caller and the workers claim one at a time, so every range
+ * lands in the one contiguous output. Only one job runs at a time; a
+ * caller that finds the pool busy just runs its job alone.
+ */
+struct _ParallelJob {
+    int mode;
+    int decoding;
+    const char* input;
+    const char* key;
+    char* output;
+    size_t length;
+    size_t numRanges;
+    size_t nextRange;		// Claimed atomically
+    size_t firstBad;		// Lowest bad offset found, guarded by poolLock
+    int workersActive;		// Guarded by poolLock
+};
+
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t poolJobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t poolIdle = PTHREAD_COND_INITIALIZER;
+static struct _ParallelJob* poolJob = NULL;
+static unsigned long poolGeneration = 0;
+static int poolThreads = 0;
+
 /*********************************************************************
- * int getCharVal(char character)
- *  Gets the numerical value of a character
- * Arguments:
- * 	char character - the character to translate
+ * static void _runRanges(struct _ParallelJob* job)
+ *  Claims and transforms ranges of the job until none are left
+*********************************************************************/
+static void _runRanges(struct _ParallelJob* job)
+{
+    while (1)
+    {
+        size_t range = __atomic_fetch_add(&job->nextRange, 1, __ATOMIC_RELAXED);
+        if (range >= job->numRanges) {break;}
+
+        size_t start = range * OTP_PARALLEL_RANGE;
+        size_t length = job->length - start < OTP_PARALLEL_RANGE ? job->length - start : OTP_PARALLEL_RANGE;
+        // Nothing past an earlier bad symbol matters
+        if (start > __atomic_load_n(&job->firstBad, __ATOMIC_RELAXED)) {continue;}
+
+        size_t done = _kernelPass(job->mode, job->decoding, job->input + start, job->key + start, job->output + start, length);
+        if (done < length)
+        {
+            pthread_mutex_lock(&poolLock);
+            if (start + done < job->firstBad) {__atomic_store_n(&job->firstBad, start + done, __ATOMIC_RELAXED);}
+            pthread_mutex_unlock(&poolLock);
+        }
+    }
+}
+
+/*********************************************************************
+ * static void* _poolWorker(void* unused)
+ *  Waits for jobs and helps with each one as it is posted
+*********************************************************************/
+static void* _poolWorker(void* unused)
+{
+    (void) unused;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&poolLock);
+    while (1)
+    {
+        while (poolGeneration == seen) {pthread_cond_wait(&poolWork, &poolLock);}
+        seen = poolGeneration;
+        // The job may already be finished by the time this thread wakes
+        struct _ParallelJob* job = poolJob;
+        if (job == NULL) {continue;}
+
+        job->workersActive++;
+        pthread_mutex_unlock(&poolLock);
+        _runRanges(job);
+        pthread_mutex_lock(&poolLock);
+        if (--job->workersActive == 0) {pthread_cond_signal(&poolIdle);}
+    }
+    return NULL;
+}
+
+/*********************************************************************
+ * static void _startPool(void)
+ *  Starts one worker per online CPU, less one for the caller.
+ *  OTP_THREADS overrides the count.
+*********************************************************************/
+static void _startPool(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    char* requested = getenv("OTP_THREADS");
+    if (requested != NULL) {count = atol(requested);}
+    if (count > OTP_PARALLEL_MAX_THREADS) {count = OTP_PARALLEL_MAX_THREADS;}
+
+    int index;
+    for (index = 0; index < count - 1; index++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, _poolWorker, NULL) != 0) {break;}
+        pthread_detach(thread);
+        poolThreads++;
+    }
+}
+
+/*********************************************************************
+ * static size_t _parallelPass(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
+ *  Runs the kernels over length symbols on the thread pool. Inputs
+ *  under OTP_PARALLEL_THRESHOLD stay on the calling thread.
  * Returns:
- * 	int - the int value of the character
- *  -1 if failed
+ * 	size_t - the number of symbols transformed, which is the offset of
+ *  the first invalid symbol if it is less than length
 *********************************************************************/
-int getCharVal(char character)
+static size_t _parallelPass(int mode, int decoding, const char* input, const char* key, char* output, size_t length)
 {
-    if (character >= 'A' && character <= 'Z')
+    if (length < OTP_PARALLEL_THRESHOLD) {return _kernelPass(mode, decoding, input, key, output, length);}
+    pthread_once(&poolOnce, _startPool);
+    if (poolThreads == 0 || pthread_mutex_trylock(&poolJobLock) != 0)
     {
-        return character - 'A';
+        return _kernelPass(mode, decoding, input, key, output, length);
     }
-    else if (character == ' ')
+
+    struct _ParallelJob job = {mode, decoding, input, key, output, length,
+        (length + OTP_PARALLEL_RANGE - 1) / OTP_PARALLEL_RANGE, 0, length, 0};
+
+    // Post the job, help with it, then wait for the workers to let go
+    pthread_mutex_lock(&poolLock);
+    poolJob = &job;
+    poolGeneration++;
+    pthread_cond_broadcast(&poolWork);
+    pthread_mutex_unlock(&poolLock);
+
+    _runRanges(&job);
+
+    pthread_mutex_lock(&poolLock);
+    while (job.workersActive > 0) {pthread_cond_wait(&poolIdle, &poolLock);}
+    poolJob = NULL;
+    pthread_mutex_unlock(&poolLock);
+    pthread_mutex_unlock(&poolJobLock);
+
+    return job.firstBad;
+}
+
+/*********************************************************************
+ * static int _transformInto(int mode, int decoding, int parallel, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+ *  Validates and transforms input in one pass. Outside raw mode a
+ *  trailing newline is copied through unchanged.
+ * Arguments:
+ *  int mode - the OTP_MODE alphabet
+ *  int decoding - 0 to encode, 1 to decode
+ *  int parallel - 1 to spread large inputs across the thread pool
+ * 	const char* input - the bytes to transform
+ *  size_t inputLength - the number of bytes in input
+ *  const char* key - the key to transform them with
+ *  size_t keyLength - the number of bytes in key
+ *  char* output - where inputLength result bytes are stored. May be
+ *  	input or key itself, but must not partially overlap either.
+ *  size_t* errorOffset - where the offset of the first bad symbol is
+ *  	stored on failure
+ * Returns:
+ * 	OTP_SUCCESS, or an OTP_ERR code on failure
+*********************************************************************/
+static int _transformInto(int mode, int decoding, int parallel, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+{
+    size_t length = inputLength;
+    if (mode != OTP_MODE_RAW && length > 0 && input[length - 1] == '\n') {length--;}
+    if (keyLength < length)
     {
-        return 26;
+        *errorOffset = keyLength;
+        return OTP_ERR_KEYSHORT;
     }
-    else
+
+    size_t done = parallel ? _parallelPass(mode, decoding, input, key, output, length) : _kernelPass(mode, decoding, input, key, output, length);
+    if (done < length)
     {
-        fprintf(stderr, "ERROR invalid character '%c' detected\n", character);
-        exit(1);
+        *errorOffset = done;
+        // Kernels never store over the bad symbol, so this holds in place
+        return _symbolValue(mode, input[done]) < 0 ? OTP_ERR_BADTEXT : OTP_ERR_BADKEY;
     }
-    return -1;
+    if (length < inputLength) {output[length] = '\n';}
+
+    return OTP_SUCCESS;
 }
 
 /*********************************************************************
- * char getIntChar(int value)
- *  Gets character of the integer value
+ * int OTP_encodeInto(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+ *  Encodes into a caller-provided buffer without allocating. The
+ *  output may be the input buffer itself to encode in place.
  * Arguments:
- * 	int value - the integer to translate
+ *  int mode - the OTP_MODE alphabet
+ * 	const char* input - the plaintext, not necessarily NUL terminated
+ *  size_t inputLength - the number of bytes of plaintext
+ *  const char* key - the key
+ *  size_t keyLength - the number of bytes of key
+ *  char* output - where inputLength bytes of ciphertext are stored
+ *  size_t* errorOffset - where the offset of the first bad symbol is
+ *  	stored on failure
  * Returns:
- * 	char - the character of the int value
- *  -1 if failed
+ * 	OTP_SUCCESS, or an OTP_ERR code on failure
 *********************************************************************/
-char getIntChar(int value)
+int OTP_encodeInto(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
 {
-    if (value == OTP_NUMCHARS - 1) {return ' ';}
-    else if (value < OTP_NUMCHARS) {return (char) value + 'A';}
-    else
+    return _transformInto(mode, 0, 0, input, inputLength, key, keyLength, output, errorOffset);
+}
+
+/*********************************************************************
+ * int OTP_decodeInto(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+ *  Decodes into a caller-provided buffer. See OTP_encodeInto.
+ * Arguments:
+ *  int mode - the OTP_MODE alphabet
+ * 	const char* input - the ciphertext, not necessarily NUL terminated
+ *  size_t inputLength - the number of bytes of ciphertext
+ *  const char* key - the key
+ *  size_t keyLength - the number of bytes of key
+ *  char* output - where inputLength bytes of plaintext are stored
+ *  size_t* errorOffset - where the offset of the first bad symbol is
+ *  	stored on failure
+ * Returns:
+ * 	OTP_SUCCESS, or an OTP_ERR code on failure
+*********************************************************************/
+int OTP_decodeInto(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+{
+    return _transformInto(mode, 1, 0, input, inputLength, key, keyLength, output, errorOffset);
+}
+
+/*********************************************************************
+ * int OTP_encodeParallel(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+ *  Encodes like OTP_encodeInto, spreading inputs of at least
+ *  OTP_PARALLEL_THRESHOLD bytes across a fixed pool of threads
+ * Arguments:
+ *  int mode - the OTP_MODE alphabet
+ * 	const char* input - the plaintext, not necessarily NUL terminated
+ *  size_t inputLength - the number of bytes of plaintext
+ *  const char* key - the key
+ *  size_t keyLength - the number of bytes of key
+ *  char* output - where inputLength bytes of ciphertext are stored
+ *  size_t* errorOffset - where the offset of the first bad symbol is
+ *  	stored on failure
+ * Returns:
+ * 	OTP_SUCCESS, or an OTP_ERR code on failure
+*********************************************************************/
+int OTP_encodeParallel(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+{
+    return _transformInto(mode, 0, 1, input, inputLength, key, keyLength, output, errorOffset);
+}
+
+/*********************************************************************
+ * int OTP_decodeParallel(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+ *  Decodes like OTP_decodeInto on the thread pool. See
+ *  OTP_encodeParallel.
+ * Returns:
+ * 	OTP_SUCCESS, or an OTP_ERR code on failure
+*********************************************************************/
+int OTP_decodeParallel(int mode, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* errorOffset)
+{
+    return _transformInto(mode, 1, 1, input, inputLength, key, keyLength, output, errorOffset);
+}
+
+/*********************************************************************
+ * static int _runCodec(int mode, int decoding, const char* input, const char* key, char** output, size_t* errorOffset)
+ *  Transforms a NUL terminated string into a newly allocated one
+ * Arguments:
+ *  int mode - the OTP_MODE alphabet
+ *  int decoding - 0 to encode, 1 to decode
+ * 	const char* input - the string to transform
+ *  const char* key - the key to transform it with
+ *  char** output - where the newly allocated result is stored
+ *  size_t* errorOffset - where the offset of the first bad symbol is
+ *  	stored on failure
+ * Returns:
+ * 	OTP_SUCCESS, or an OTP_ERR code on failure
+*********************************************************************/
+static int _runCodec(int mode, int decoding, const char* input, const char* key, char** output, size_t* errorOffset)
+{
+    // The length is needed up front to size the output. The key is only
+    // scanned as far as the input reaches.
+    size_t inputLength = strlen(input);
+    size_t keyLength = strnlen(key, inputLength);
+
+    *output = malloc((inputLength + 1) * sizeof(char));
+    int result = _transformInto(mode, decoding, 1, input, inputLength, key, keyLength, *output, errorOffset);
+    if (result != OTP_SUCCESS)
     {
-        fprintf(stderr, "ERROR invalid value '%d' detected\n", value);
-        exit(1);
+        free(*output);
+        *output = NULL;
+        return result;
     }
-    return -1;
+    (*output)[inputLength] = '\0';
+
+    return OTP_SUCCESS;
 }
 
 /*********************************************************************
@@ -146,26 +1696,11 @@ char getIntChar(int value)
  * 	struct OneTimePad* encoder - the location of the struct that holds
  *  the plaintext file, the key, and the ciphertext
  * Returns:
- * 	0 on success
+ * 	OTP_SUCCESS, or an OTP_ERR code with encoder->errorOffset set
 *********************************************************************/
 int OTP_encode(struct OneTimePad* encoder)
 {
-    int plaintextLength = strlen(encoder->plaintext), keyLength = strlen(encoder->key);
-    if (plaintextLength > keyLength) {error("ERROR plaintext length greater than key length\n");}
-    char plaintextCharacter, keyCharacter;
-    encoder->ciphertext = malloc((plaintextLength + 1) * sizeof(char));
-
-    int index;
-    for(index = 0; index < plaintextLength - 1; index++)
-    {
-        int messageKey = getCharVal(encoder->plaintext[index]) + getCharVal(encoder->key[index]);
-        char cipherChar = getIntChar(messageKey % OTP_NUMCHARS);
-        (encoder->ciphertext)[index] = cipherChar;
-    }
-    (encoder->ciphertext)[index] = '\n';
-    (encoder->ciphertext)[index+1] = '\0';
-
-    return 0;
+    return _runCodec(encoder->mode, 0, encoder->plaintext, encoder->key, &encoder->ciphertext, &encoder->errorOffset);
 }
 
 /*********************************************************************
@@ -175,28 +1710,281 @@ int OTP_encode(struct OneTimePad* encoder)
  * 	struct OneTimePad* decoder - the location of the struct that holds
  *  the plaintext file, the key, and the ciphertext
  * Returns:
- * 	0 on success
+ * 	OTP_SUCCESS, or an OTP_ERR code with decoder->errorOffset set
 *********************************************************************/
 int OTP_decode(struct OneTimePad* decoder)
 {
-    int ciphertextLength = strlen(decoder->ciphertext), keyLength = strlen(decoder->key);
-    if (ciphertextLength > keyLength) {error("ERROR ciphertext length greater than key length\n");}
-    char ciphertextCharacter, keyCharacter;
-    decoder->plaintext = malloc((ciphertextLength + 1) * sizeof(char));
+    return _runCodec(decoder->mode, 1, decoder->ciphertext, decoder->key, &decoder->plaintext, &decoder->errorOffset);
+}
 
-    int index;
-    for(index = 0; index < ciphertextLength - 1; index++)
+/*********************************************************************
+ * const char* OTP_errorString(int code)
+ *  Describes a codec result code
+ * Arguments:
+ * 	int code - the code returned by the codec
+ * Returns:
+ * 	const char* - a short description of the code
+*********************************************************************/
+const char* OTP_errorString(int code)
+{
+    switch (code)
     {
-        int messageKey = getCharVal(decoder->ciphertext[index]) - getCharVal(decoder->key[index]);
-        char plainChar = getIntChar((messageKey + OTP_NUMCHARS) % OTP_NUMCHARS);
-        decoder->plaintext[index] = plainChar;
+        case OTP_SUCCESS: return "success";
+        case OTP_ERR_BADTEXT: return "invalid character in input";
+        case OTP_ERR_BADKEY: return "invalid character in key";
+        case OTP_ERR_KEYSHORT: return "key is too short";
+        case OTP_ERR_FILE: return "could not read file";
+        case OTP_ERR_NOKEY: return "no such stored key";
+        case OTP_ERR_KEYUSED: return "key range already used";
+        default: return "unknown error";
     }
-    (decoder->plaintext)[index] = '\n';
-    (decoder->plaintext)[index+1] = '\0';
+}
+
+/*********************************************************************
+ * int OTP_streamInit(struct OTP_Stream* stream, int mode, int decoding)
+ *  Prepares a stream to encode or decode chunks as they arrive
+ * Arguments:
+ * 	struct OTP_Stream* stream - the stream to prepare
+ *  int mode - the OTP_MODE alphabet
+ *  int decoding - 0 to encode, 1 to decode
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_streamInit(struct OTP_Stream* stream, int mode, int decoding)
+{
+    stream->mode = mode;
+    stream->decoding = decoding;
+    stream->offset = 0;
+    stream->finished = 0;
+    stream->result = OTP_SUCCESS;
+    OTP_bufferInit(&stream->pending, 0);
+    stream->pendingStart = 0;
+    stream->pendingIsKey = 0;
 
     return 0;
 }
 
+/*********************************************************************
+ * size_t OTP_streamBound(const struct OTP_Stream* stream, size_t inputLength)
+ *  Gets the most output the next update can produce
+ * Arguments:
+ * 	const struct OTP_Stream* stream - the stream to be updated
+ *  size_t inputLength - the number of input bytes the update brings
+ * Returns:
+ * 	size_t - the size the update's output buffer must have
+*********************************************************************/
+size_t OTP_streamBound(const struct OTP_Stream* stream, size_t inputLength)
+{
+    return inputLength + (stream->pendingIsKey ? 0 : stream->pending.length - stream->pendingStart);
+}
+
+/*********************************************************************
+ * static size_t _streamRun(struct OTP_Stream* stream, const char* input, const char* key, char* output, size_t length)
+ *  Transforms the next length symbols of the stream. Outside raw mode a
+ *  newline in the input ends the stream and is copied through, the
+ *  same as the trailing newline of OTP_encode, so any text after it
+ *  fails the stream at the newline. Any other bad symbol fails it.
+ * Returns:
+ * 	size_t - the number of bytes written to output
+*********************************************************************/
+static size_t _streamRun(struct OTP_Stream* stream, const char* input, const char* key, char* output, size_t length)
+{
+    size_t done = _kernelPass(stream->mode, stream->decoding, input, key, output, length);
+    stream->offset += done;
+    if (done == length) {return done;}
+
+    if (input[done] == '\n')
+    {
+        output[done] = '\n';
+        stream->finished = 1;
+        if (done + 1 < length) {stream->result = OTP_ERR_BADTEXT;}
+        return done + 1;
+    }
+    stream->result = _symbolValue(stream->mode, input[done]) < 0 ? OTP_ERR_BADTEXT : OTP_ERR_BADKEY;
+    return done;
+}
+
+/*********************************************************************
+ * static void _streamSave(struct OTP_Stream* stream, const char* data, size_t length, int isKey)
+ *  Holds on to the bytes of whichever side is ahead of the other
+*********************************************************************/
+static void _streamSave(struct OTP_Stream* stream, const char* data, size_t length, int isKey)
+{
+    if (length == 0) {return;}
+    if (stream->pending.length == stream->pendingStart)
+    {
+        stream->pending.length = stream->pendingStart = 0;
+        stream->pendingIsKey = isKey;
+    }
+    // Slide the unread bytes back to the front before growing
+    if (stream->pendingStart > 0)
+    {
+        stream->pending.length -= stream->pendingStart;
+        memmove(stream->pending.data, stream->pending.data + stream->pendingStart, stream->pending.length);
+        stream->pendingStart = 0;
+    }
+    OTP_bufferAppend(&stream->pending, data, length);
+}
+
+/*********************************************************************
+ * static int _streamTrailing(struct OTP_Stream* stream, size_t trailing)
+ *  Fails a stream that has seen its newline if text still follows it
+ * Returns:
+ * 	OTP_SUCCESS, or OTP_ERR_BADTEXT with stream->offset at the newline
+*********************************************************************/
+static int _streamTrailing(struct OTP_Stream* stream, size_t trailing)
+{
+    if (stream->result == OTP_SUCCESS && trailing > 0) {stream->result = OTP_ERR_BADTEXT;}
+    return stream->result;
+}
+
+/*********************************************************************
+ * int OTP_streamUpdate(struct OTP_Stream* stream, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* outputLength)
+ *  Feeds the stream whatever input and key bytes have arrived, in any
+ *  chunk sizes, and transforms as much as both sides cover. Bytes of
+ *  the side that is ahead are held until the other side catches up.
+ * Arguments:
+ * 	struct OTP_Stream* stream - the stream to feed
+ *  const char* input - newly arrived input bytes (may be NULL if none)
+ *  size_t inputLength - the number of input bytes
+ *  const char* key - newly arrived key bytes (may be NULL if none)
+ *  size_t keyLength - the number of key bytes
+ *  char* output - where the result is stored, at least
+ *  	OTP_streamBound(stream, inputLength) bytes
+ *  size_t* outputLength - where the number of output bytes is stored
+ * Returns:
+ * 	OTP_SUCCESS, or an OTP_ERR code with stream->offset at the bad symbol
+*********************************************************************/
+int OTP_streamUpdate(struct OTP_Stream* stream, const char* input, size_t inputLength, const char* key, size_t keyLength, char* output, size_t* outputLength)
+{
+    *outputLength = 0;
+    if (stream->finished) {return _streamTrailing(stream, inputLength);}
+    if (stream->result != OTP_SUCCESS) {return stream->result;}
+
+    // Catch the held side up with what the other side just delivered
+    size_t heldLength = stream->pending.length - stream->pendingStart;
+    if (heldLength > 0)
+    {
+        const char* held = stream->pending.data + stream->pendingStart;
+        size_t length;
+        if (stream->pendingIsKey)
+        {
+            length = inputLength < heldLength ? inputLength : heldLength;
+            *outputLength += _streamRun(stream, input, held, output, length);
+            input += length;
+            inputLength -= length;
+        }
+        else
+        {
+            length = keyLength < heldLength ? keyLength : heldLength;
+            *outputLength += _streamRun(stream, held, key, output, length);
+            key += length;
+            keyLength -= length;
+        }
+        stream->pendingStart += length;
+        if (stream->finished) {return _streamTrailing(stream, inputLength + (stream->pendingIsKey ? 0 : stream->pending.length - stream->pendingStart));}
+        if (stream->result != OTP_SUCCESS) {return stream->result;}
+
+        // Still behind, so everything new on the held side waits too
+        if (stream->pendingStart < stream->pending.length)
+        {
+            _streamSave(stream, stream->pendingIsKey ? key : input, stream->pendingIsKey ? keyLength : inputLength, stream->pendingIsKey);
+            return OTP_SUCCESS;
+        }
+    }
+
+    // Transform what both new chunks cover, then hold the rest
+    size_t length = inputLength < keyLength ? inputLength : keyLength;
+    *outputLength += _streamRun(stream, input, key, output + *outputLength, length);
+    if (stream->finished) {return _streamTrailing(stream, inputLength - length);}
+    if (stream->result != OTP_SUCCESS) {return stream->result;}
+    _streamSave(stream, input + length, inputLength - length, 0);
+    _streamSave(stream, key + length, keyLength - length, 1);
+
+    return OTP_SUCCESS;
+}
+
+/*********************************************************************
+ * int OTP_streamFinish(struct OTP_Stream* stream)
+ *  Ends a stream once both sides are complete and frees its memory
+ * Arguments:
+ * 	struct OTP_Stream* stream - the stream to end
+ * Returns:
+ * 	OTP_SUCCESS, or an OTP_ERR code with stream->offset at the bad
+ *  symbol (OTP_ERR_KEYSHORT if input is still waiting on key)
+*********************************************************************/
+int OTP_streamFinish(struct OTP_Stream* stream)
+{
+    if (stream->result == OTP_SUCCESS && !stream->finished && stream->pending.length > stream->pendingStart && !stream->pendingIsKey)
+    {
+        stream->result = OTP_ERR_KEYSHORT;
+    }
+    OTP_bufferFree(&stream->pending);
+    stream->pendingStart = 0;
+
+    return stream->result;
+}
+
+/*********************************************************************
+ * int OTP_streamFiles(int mode, int decoding, int inputFD, size_t inputLength, int keyFD, size_t keyLength, struct OTP_Buffer* output, size_t* errorOffset)
+ *  Encodes or decodes a whole file in-process, feeding memory
+ *  mappings of the input and key through the same stream the daemon
+ *  runs, so the result is byte for byte what it would send back
+ * Arguments:
+ * 	int mode - the OTP_MODE alphabet
+ *  int decoding - 0 to encode, 1 to decode
+ *  int inputFD - the open input file
+ *  size_t inputLength - the number of bytes in it
+ *  int keyFD - the open key file
+ *  size_t keyLength - the number of bytes in it
+ *  struct OTP_Buffer* output - where the result is appended
+ *  size_t* errorOffset - where the offset of a bad symbol is stored
+ * Returns:
+ * 	OTP_SUCCESS, or the OTP_ERR code the daemon would have answered
+ *  with, OTP_ERR_FILE if a file can't be mapped
+*********************************************************************/
+int OTP_streamFiles(int mode, int decoding, int inputFD, size_t inputLength, int keyFD, size_t keyLength, struct OTP_Buffer* output, size_t* errorOffset)
+{
+    struct OTP_Stream stream;
+    size_t produced = 0;
+    char* input = inputLength > 0 ? mmap(NULL, inputLength, PROT_READ, MAP_PRIVATE, inputFD, 0) : NULL;
+    char* key = keyLength > 0 ? mmap(NULL, keyLength, PROT_READ, MAP_PRIVATE, keyFD, 0) : NULL;
+    if (input == MAP_FAILED || key == MAP_FAILED)
+    {
+        if (input != NULL && input != MAP_FAILED) {munmap(input, inputLength);}
+        if (key != NULL && key != MAP_FAILED) {munmap(key, keyLength);}
+        *errorOffset = 0;
+        return OTP_ERR_FILE;
+    }
+    // Both are read front to back, once
+    if (input != NULL) {madvise(input, inputLength, MADV_SEQUENTIAL);}
+    if (key != NULL) {madvise(key, keyLength, MADV_SEQUENTIAL);}
+
+    OTP_streamInit(&stream, mode, decoding);
+    char* end = OTP_bufferReserve(output, OTP_streamBound(&stream, inputLength));
+    if (end != NULL) {OTP_streamUpdate(&stream, input, inputLength, key, keyLength, end, &produced);}
+    int result = OTP_streamFinish(&stream);
+    if (end == NULL) {result = OTP_ERR_FILE;}
+
+    *errorOffset = stream.offset;
+    if (result == OTP_SUCCESS) {output->length += produced;}
+    if (input != NULL) {munmap(input, inputLength);}
+    if (key != NULL) {munmap(key, keyLength);}
+    return result;
+}
+
+/*********************************************************************
+ * int OTP_apiVersion(void)
+ *  Gets the OTP_API_VERSION the library was built with, for a program
+ *  to check against the otp.h it was compiled with
+ * Returns:
+ * 	int - the version
+*********************************************************************/
+int OTP_apiVersion(void)
+{
+    return OTP_API_VERSION;
+}
+
 /*********************************************************************
  * int initOTP(struct OneTimePad* pad)
  *  Initializes the OneTimePad struct
@@ -212,6 +2000,8 @@ int initOTP(struct OneTimePad* pad)
 	pad->plaintext = NULL;
 	pad->key = NULL;
 	pad->ciphertext = NULL;
+	pad->errorOffset = 0;
+	pad->mode = OTP_MODE_ALPHA27;
 
 	return 0;
 }
@@ -240,41 +2030,121 @@ int freeOTP(struct OneTimePad* pad)
 		free(pad->ciphertext);
 	}
 
-    return 0;
+	// Leave the pad empty so it can be reused for the next request
+	return initOTP(pad);
 }
 
 /*********************************************************************
- * int appendString(char** string, char* input)
- *  Appends a string into another string
+ * int OTP_bufferInit(struct OTP_Buffer* buffer, size_t sizeHint)
+ *  Prepares an empty buffer, allocating room for sizeHint bytes up
+ *  front when the final size is known or can be guessed
  * Arguments:
- * 	char** string - the location of the string to be appended to
- *  char* input - the string to add to the first string
+ * 	struct OTP_Buffer* buffer - the buffer to prepare
+ *  size_t sizeHint - the number of bytes to make room for (may be 0)
  * Returns:
- * 	0 on success
+ * 	0 on success, -1 if the memory could not be allocated
 *********************************************************************/
-int appendString(char** string, char* input)
+int OTP_bufferInit(struct OTP_Buffer* buffer, size_t sizeHint)
 {
-    // If the string is not empty, combine string and input
-    if (*string != NULL)
-    {
-        // Make a temporary string
-        size_t newLength = strlen(*string) + strlen(input) + 1;
-        char* temp = malloc(newLength * sizeof(char));
-        // Combine old string and input into temporary string
-        sprintf(temp, "%s%s", *string, input);
-        // Save new string
-        free(*string);
-        *string = malloc(newLength * sizeof(char));
-        strcpy(*string, temp);
-        // Deallocate Temp
-        free(temp);
-    }
-    // Otherwise, initialize the empty string and set it to the input;
-    else
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    if (sizeHint == 0) {return 0;}
+
+    return OTP_bufferReserve(buffer, sizeHint) != NULL ? 0 : -1;
+}
+
+/*********************************************************************
+ * char* OTP_bufferReserve(struct OTP_Buffer* buffer, size_t extra)
+ *  Makes sure extra more bytes (and the trailing NUL) fit, doubling
+ *  the capacity as many times as needed
+ * Arguments:
+ * 	struct OTP_Buffer* buffer - the buffer to grow
+ *  size_t extra - the number of bytes about to be added
+ * Returns:
+ * 	char* - where the next bytes go, or NULL if the memory could not
+ *  be allocated
+*********************************************************************/
+char* OTP_bufferReserve(struct OTP_Buffer* buffer, size_t extra)
+{
+    if (buffer->length + extra + 1 > buffer->capacity)
     {
-        *string = malloc(strlen(input) * sizeof(char));
-        strcpy(*string, input);
+        size_t capacity = buffer->capacity ? buffer->capacity : OTP_BUFFERSIZE;
+        while (capacity < buffer->length + extra + 1) {capacity *= 2;}
+        char* grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {return NULL;}
+        buffer->data = grown;
+        buffer->capacity = capacity;
+        buffer->data[buffer->length] = '\0';
     }
 
+    return buffer->data + buffer->length;
+}
+
+/*********************************************************************
+ * int OTP_bufferAppend(struct OTP_Buffer* buffer, const char* data, size_t length)
+ *  Copies bytes onto the end of a buffer
+ * Arguments:
+ * 	struct OTP_Buffer* buffer - the buffer to add to
+ *  const char* data - the bytes to add, which may hold NULs
+ *  size_t length - the number of bytes to add
+ * Returns:
+ * 	0 on success, -1 if the memory could not be allocated
+*********************************************************************/
+int OTP_bufferAppend(struct OTP_Buffer* buffer, const char* data, size_t length)
+{
+    char* end = OTP_bufferReserve(buffer, length);
+    if (end == NULL) {return -1;}
+    memcpy(end, data, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+
     return 0;
-}
\ No newline at end of file
+}
+
+/*********************************************************************
+ * int OTP_bufferFree(struct OTP_Buffer* buffer)
+ *  Frees a buffer's memory and leaves it empty for reuse
+ * Arguments:
+ * 	struct OTP_Buffer* buffer - the buffer to free
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_bufferFree(struct OTP_Buffer* buffer)
+{
+    free(buffer->data);
+    return OTP_bufferInit(buffer, 0);
+}
+
+/*********************************************************************
+ * void OTP_fillPayload(char* buffer, size_t length, int mode)
+ *  Fills a buffer with random symbols of an alphabet, for the
+ *  benchmarks to encode
+ * Arguments:
+ * 	char* buffer - the buffer to fill, with room for length + 1 bytes
+ *  size_t length - the number of symbols to write
+ *  int mode - the OTP_MODE alphabet
+*********************************************************************/
+void OTP_fillPayload(char* buffer, size_t length, int mode)
+{
+	size_t index;
+	for (index = 0; index < length; index++)
+	{
+		int value = rand();
+		if (mode == OTP_MODE_ALPHA27) {value %= OTP_NUMCHARS; buffer[index] = value == 26 ? ' ' : 'A' + value;}
+		else if (mode == OTP_MODE_PRINTABLE) {buffer[index] = ' ' + value % OTP_PRINTABLE_CHARS;}
+		else {buffer[index] = (char) value;}
+	}
+	buffer[length] = '\0';
+}
+
+/*********************************************************************
+ * double OTP_readSeconds(void)
+ *  Reads a monotonic clock in seconds, for the benchmarks to time with
+*********************************************************************/
+double OTP_readSeconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
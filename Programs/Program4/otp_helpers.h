@@ -6,36 +6,153 @@
 **  Program Function:
 **      These are the helper functions for otp_enc, otp_dec,
 **      otp_enc_d, and otp_dec_d. These programs encode and decode
-**      text using a key. This is the header file.
+**      text using a key. The codec itself is libotp's public API,
+**      declared in otp.h; the rest here is for the programs
+**      themselves. This is the header file.
 *********************************************************************/
 #ifndef OTP_HELPERS_H
 #define OTP_HELPERS_H
 
+#include "otp.h"
+
 #define OTP_BUFFERSIZE 256
 #define OTP_MAX_CONNECTIONS 5
 #define OTP_NUMCHARS 27
+#define OTP_PRINTABLE_CHARS 95
+
+// Parallel Codec
+#define OTP_PARALLEL_THRESHOLD (4 * 1024 * 1024)	// Smaller inputs stay on one thread
+#define OTP_PARALLEL_RANGE (256 * 1024)			// Bytes per unit of parallel work
+#define OTP_PARALLEL_MAX_THREADS 64
+
+// Wire Protocol. Every message is a frame: an OTP_FRAME_HEADER byte
+// header (version, opcode, flags, payload length, request ID; big
+// endian) and then the payload. Payloads never exceed the chunk size
+// agreed in the HELLO/WELCOME handshake, and need no acknowledgement.
+// After the handshake a connection carries any number of requests,
+// each TEXT then KEY, which the client may send without waiting for
+// earlier results. The daemon answers them in order, tagging each
+// reply with its request's ID. A result's DATA frames go out while
+// its KEY frames still come in; if the key turns out bad, an ERROR
+// ends the reply in place of the rest. A daemon with a key store also takes
+// KEYPUT requests, which upload a key once, and a KEYREF in place of
+// a request's KEY frames, naming a stored key and where in it to start.
+// A STATS, sent in place of the HELLO or between requests, is answered
+// with DATA frames holding the daemon's metrics as "name value" lines.
+#define OTP_PROTOCOL_VERSION 2
+#define OTP_FRAME_HEADER 12
+#define OTP_CHUNK_DEFAULT (64 * 1024)		// Chunk size clients ask for
+#define OTP_CHUNK_MAX (1024 * 1024)		// Largest chunk daemons agree to
+#define OTP_CHUNK_MIN OTP_BUFFERSIZE
+
+// Frame Opcodes
+#define OTP_OP_HELLO 1		// Client: decoding flag, mode, proposed chunk size
+#define OTP_OP_WELCOME 2	// Daemon: status (200/403/503), agreed chunk size or, if busy, ms to wait
+#define OTP_OP_TEXT 3		// Client: plaintext or ciphertext bytes
+#define OTP_OP_KEY 4		// Client: key bytes
+#define OTP_OP_DATA 5		// Daemon: result bytes
+#define OTP_OP_ERROR 6		// Daemon: OTP_ERR code and offset of the bad symbol
+#define OTP_OP_KEYPUT 7		// Client: key bytes to store
+#define OTP_OP_KEYREF 8		// Client: stored key ID and offset; Daemon: the ID and offset used
+#define OTP_OP_STATS 9		// Client: asks for the daemon's metrics
+#define OTP_HELLO_SIZE 8
+#define OTP_WELCOME_SIZE 8
+#define OTP_ERROR_SIZE 12
+#define OTP_KEYREF_SIZE 16
+#define OTP_KEY_NEXT ((size_t) -1)	// KEYREF offset asking for the key's next unused range
+#define OTP_BUSY 503		// WELCOME status of a daemon with no room for the connection
+
+// Retrying a Busy Daemon
+#define OTP_RETRY_ATTEMPTS 8	// Hellos a client sends before giving up
+#define OTP_RETRY_MIN 10		// Shortest wait before trying again, in ms
+#define OTP_RETRY_MAX 2000		// Longest, before jitter
+
+// Frame Flags
+#define OTP_FLAG_END 0x1	// Last frame of its TEXT, KEY, KEYPUT or DATA stream
+
+// Operations a daemon serves, asked for by the HELLO's decoding flag
+#define OTP_SERVE_ENCODE 0x1
+#define OTP_SERVE_DECODE 0x2
+#define OTP_SERVE_BOTH (OTP_SERVE_ENCODE | OTP_SERVE_DECODE)
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Signature shared by every encode/decode kernel. A kernel combines
+// length symbols of input with key and stores them in output, returning
+// how many leading symbols it handled before meeting an invalid one.
+typedef size_t (*OTP_kernelFunc)(const char* input, const char* key, char* output, size_t length);
+// A scan returns how many leading bytes are symbols or newlines.
+typedef size_t (*OTP_scanFunc)(const char* data, size_t length);
+
+struct OTP_Kernel {
+	const char* name;
+	int mode;
+	OTP_kernelFunc encode;
+	OTP_kernelFunc decode;
+	OTP_scanFunc validate;
+	int (*supported)(void);
+};
+
+// A decoded frame header
+struct OTP_Frame {
+	int opcode;
+	int flags;
+	size_t length;
+	unsigned long requestID;
+};
 
 struct OneTimePad {
 	char* plaintext;
 	char* key;
 	char* ciphertext;
+	size_t errorOffset;	// Offset of the first bad symbol after a failed encode/decode
+	int mode;			// OTP_MODE alphabet, OTP_MODE_ALPHA27 unless set after initOTP
 };
 
 // Error Functions
-void error(const char *msg);
+void OTP_fatal(const char *msg);
 // Send and Recieve Messages
-int checkSent(int fileDescriptor);
-int sendMessage(char* source, char* message, int fileDescriptor);
-int getResponse(char* source, char buffer[], int fileDescriptor);
+int OTP_sendAll(int fileDescriptor, const char* data, size_t length);
+int OTP_sendAllv(int fileDescriptor, struct iovec* pieces, int count);
+int OTP_recvExact(int fileDescriptor, char* data, size_t length);
+// Framing Functions
+void OTP_packHeader(char header[], int opcode, int flags, size_t length, unsigned long requestID);
+int OTP_unpackHeader(const char header[], struct OTP_Frame* frame);
+int OTP_sendFrame(int fileDescriptor, int opcode, int flags, const char* payload, size_t length, unsigned long requestID);
+int OTP_recvFrame(int fileDescriptor, struct OTP_Frame* frame, char* payload, size_t capacity);
+int OTP_sendFileFrames(int socketFD, int opcode, int fileDescriptor, size_t length, size_t chunkSize, unsigned long requestID);
+int OTP_isSocketPath(const char* destination);
+int OTP_connectTo(const char* destination);
+int OTP_clientHello(int fileDescriptor, int decoding, int mode, size_t* chunkSize);
+int OTP_clientOpen(const char* destination, int decoding, int mode, size_t* chunkSize);
+int OTP_requestStats(int socketFD, struct OTP_Buffer* text);
+int OTP_uploadKey(int socketFD, int fileDescriptor, size_t length, size_t chunkSize, unsigned long* keyID, size_t* badOffset);
+int OTP_acceptHello(const char* payload, size_t length, int serves, size_t maxChunk, int* decoding, int* mode, size_t* chunkSize);
+void OTP_packWelcome(char payload[], int status, size_t chunkSize);
+int OTP_serverHello(int fileDescriptor, int serves, int* decoding, int* mode, size_t* chunkSize);
+void OTP_packError(char payload[], int code, size_t offset);
+int OTP_sendError(int fileDescriptor, int code, size_t offset, unsigned long requestID);
+int OTP_parseError(const char* payload, size_t length, size_t* offset);
+void OTP_packKeyRef(char payload[], unsigned long keyID, size_t offset);
+int OTP_parseKeyRef(const char* payload, size_t length, unsigned long* keyID, size_t* offset);
+int OTP_parseKeyName(const char* name, unsigned long* keyID, size_t* offset);
 // Struct OneTimePad Management
 int initOTP(struct OneTimePad* pad);
 int freeOTP(struct OneTimePad* pad);
-// String Manipulation Function
-int appendString(char** string, char* input);
 // Encoding/Decoding Functions
 int getCharVal(char character);
 char getIntChar(int value);
+// Encoding/Decoding Kernels
+size_t OTP_encodeScalar(const char* input, const char* key, char* output, size_t length);
+size_t OTP_decodeScalar(const char* input, const char* key, char* output, size_t length);
+const struct OTP_Kernel* OTP_getKernels(int* count);
+const struct OTP_Kernel* OTP_selectKernel(int mode);
+// Whole-Text Encoding/Decoding Functions
 int OTP_encode(struct OneTimePad* encoder);
 int OTP_decode(struct OneTimePad* decoder);
+// Benchmark Functions
+void OTP_fillPayload(char* buffer, size_t length, int mode);
+double OTP_readSeconds(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,344 @@
+/*********************************************************************
+** Program name:    OTP
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**      These are the key store functions of otp_d: keys uploaded once
+**      and kept in a directory, mapped into memory when requests name
+**      them, with how far each has been used kept alongside it.
+*********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "otp_helpers.h"
+#include "otp_keys.h"
+
+/*********************************************************************
+ * static int _writeAt(int fd, const char* data, size_t length, off_t offset)
+ *  Writes all of data to a file at offset
+ * Returns:
+ * 	0 on success, -1 on failure
+*********************************************************************/
+static int _writeAt(int fd, const char* data, size_t length, off_t offset)
+{
+	while (length > 0)
+	{
+		ssize_t written = pwrite(fd, data, length, offset);
+		if (written < 0 && errno == EINTR) {continue;}
+		if (written <= 0) {return -1;}
+		data += written;
+		length -= written;
+		offset += written;
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_keyStoreOpen(struct OTP_KeyStore* store, const char* directory)
+ *  Opens a key store, creating its directory if there is none yet.
+ *  Processes that open the same directory share its keys and IDs.
+ * Arguments:
+ * 	struct OTP_KeyStore* store - the store to open
+ *  const char* directory - where the keys are kept
+ * Returns:
+ * 	0 on success, -1 if the directory can't be used
+*********************************************************************/
+int OTP_keyStoreOpen(struct OTP_KeyStore* store, const char* directory)
+{
+	char* path;
+	memset(store, 0, sizeof(*store));
+	if (mkdir(directory, 0700) < 0 && errno != EEXIST) {return -1;}
+	if (asprintf(&path, "%s/next", directory) < 0) {return -1;}
+
+	// The next ID lives in its own small file so every process hands
+	// out different ones
+	struct stat status;
+	int fd = open(path, O_RDWR | O_CREAT, 0600);
+	free(path);
+	if (fd < 0) {return -1;}
+	if (fstat(fd, &status) < 0 || (status.st_size < (off_t) sizeof(uint64_t) && ftruncate(fd, sizeof(uint64_t)) < 0))
+	{
+		close(fd);
+		return -1;
+	}
+	void* map = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {return -1;}
+
+	store->nextID = map;
+	store->directory = strdup(directory);
+	pthread_mutex_init(&store->lock, NULL);
+
+	return 0;
+}
+
+/*********************************************************************
+ * static struct OTP_Key* _keyMap(struct OTP_KeyStore* store, unsigned long keyID)
+ *  Maps a key file, checking its header
+ * Returns:
+ * 	struct OTP_Key* - the mapped key, or NULL if there is no such key
+*********************************************************************/
+static struct OTP_Key* _keyMap(struct OTP_KeyStore* store, unsigned long keyID)
+{
+	char* path;
+	struct stat status;
+	if (asprintf(&path, "%s/%lu.key", store->directory, keyID) < 0) {return NULL;}
+	int fd = open(path, O_RDWR);
+	free(path);
+	if (fd < 0) {return NULL;}
+	if (fstat(fd, &status) < 0 || status.st_size < OTP_KEY_HEADER) {close(fd); return NULL;}
+
+	struct OTP_KeyHeader* map = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {return NULL;}
+	if (memcmp(map->magic, OTP_KEY_MAGIC, sizeof(OTP_KEY_MAGIC)) != 0 || map->length > (uint64_t) status.st_size - OTP_KEY_HEADER || map->mode >= OTP_NUM_MODES)
+	{
+		munmap(map, status.st_size);
+		return NULL;
+	}
+
+	struct OTP_Key* key = malloc(sizeof(struct OTP_Key));
+	key->data = (const char*) map + OTP_KEY_HEADER;
+	key->length = map->length;
+	key->mode = map->mode;
+	key->consumed = &map->consumed;
+	key->map = map;
+	key->mapLength = status.st_size;
+
+	return key;
+}
+
+/*********************************************************************
+ * const struct OTP_Key* OTP_keyStoreGet(struct OTP_KeyStore* store, unsigned long keyID)
+ *  Finds a stored key, mapping it the first time it is asked for
+ * Arguments:
+ * 	struct OTP_KeyStore* store - the store
+ *  unsigned long keyID - the key's ID
+ * Returns:
+ * 	const struct OTP_Key* - the key, or NULL if there is no such key
+*********************************************************************/
+const struct OTP_Key* OTP_keyStoreGet(struct OTP_KeyStore* store, unsigned long keyID)
+{
+	struct OTP_Key* key = NULL;
+	if (keyID == 0 || keyID >= OTP_KEYS_MAX) {return NULL;}
+
+	pthread_mutex_lock(&store->lock);
+	if (keyID < store->capacity) {key = store->keys[keyID];}
+	if (key == NULL && (key = _keyMap(store, keyID)) != NULL)
+	{
+		// Keep it for the requests that name it next
+		if (keyID >= store->capacity)
+		{
+			size_t capacity = store->capacity > 0 ? store->capacity : 16;
+			while (capacity <= keyID) {capacity *= 2;}
+			store->keys = realloc(store->keys, capacity * sizeof(struct OTP_Key*));
+			memset(store->keys + store->capacity, 0, (capacity - store->capacity) * sizeof(struct OTP_Key*));
+			store->capacity = capacity;
+		}
+		store->keys[keyID] = key;
+	}
+	pthread_mutex_unlock(&store->lock);
+
+	return key;
+}
+
+/*********************************************************************
+ * int OTP_keyStoreClose(struct OTP_KeyStore* store)
+ *  Unmaps every key and frees the store. The keys stay on disk.
+ * Arguments:
+ * 	struct OTP_KeyStore* store - the store
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_keyStoreClose(struct OTP_KeyStore* store)
+{
+	size_t index;
+	for (index = 0; index < store->capacity; index++)
+	{
+		if (store->keys[index] == NULL) {continue;}
+		munmap(store->keys[index]->map, store->keys[index]->mapLength);
+		free(store->keys[index]);
+	}
+	free(store->keys);
+	munmap(store->nextID, sizeof(uint64_t));
+	free(store->directory);
+	pthread_mutex_destroy(&store->lock);
+
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_keyReserve(const struct OTP_Key* key, size_t* offset, size_t length)
+ *  Claims a range of a key to encode with, so that no other request,
+ *  in this process or any other, is ever given the same pad
+ * Arguments:
+ * 	const struct OTP_Key* key - the stored key
+ *  size_t* offset - where the range starts, or OTP_KEY_NEXT for the
+ *  	first unused symbol; the start tried is stored back
+ *  size_t length - the number of symbols to claim
+ * Returns:
+ * 	OTP_SUCCESS, OTP_ERR_KEYUSED if the range starts before the
+ *  unused part of the key, OTP_ERR_KEYSHORT if it runs off its end, or
+ *  OTP_ERR_FILE if the claim could not be written to disk, in which
+ *  case the range stays claimed but must not be used
+*********************************************************************/
+int OTP_keyReserve(const struct OTP_Key* key, size_t* offset, size_t length)
+{
+	uint64_t consumed = __atomic_load_n(key->consumed, __ATOMIC_ACQUIRE);
+	while (1)
+	{
+		size_t start = *offset == OTP_KEY_NEXT ? consumed : *offset;
+		if (start < consumed) {return OTP_ERR_KEYUSED;}
+		if (start > key->length || length > key->length - start) {*offset = start; return OTP_ERR_KEYSHORT;}
+
+		// Another request may have claimed a range since the load; if
+		// so, consumed now holds its end and the check is made again
+		if (__atomic_compare_exchange_n(key->consumed, &consumed, start + length, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			// The claim must reach the disk before any of the pad is
+			// sent, or a crash could hand the same range out again
+			*offset = start;
+			return msync(key->map, OTP_KEY_HEADER, MS_SYNC) < 0 ? OTP_ERR_FILE : OTP_SUCCESS;
+		}
+	}
+}
+
+/*********************************************************************
+ * int OTP_keyUploadBegin(struct OTP_KeyStore* store, struct OTP_KeyUpload* upload, int mode)
+ *  Starts receiving a key into a temporary file in the store. If it
+ *  can't, the upload still takes in the key, and commits to an error.
+ * Arguments:
+ * 	struct OTP_KeyStore* store - the store, or NULL if there is none
+ *  struct OTP_KeyUpload* upload - the upload to start
+ *  int mode - the OTP_MODE alphabet the key must use
+ * Returns:
+ * 	0 on success, -1 if the file can't be created
+*********************************************************************/
+int OTP_keyUploadBegin(struct OTP_KeyStore* store, struct OTP_KeyUpload* upload, int mode)
+{
+	upload->fd = -1;
+	upload->mode = mode;
+	upload->length = upload->usable = 0;
+	upload->result = store == NULL ? OTP_ERR_NOKEY : OTP_ERR_FILE;
+	upload->badOffset = 0;
+	if (store == NULL || asprintf(&upload->path, "%s/upload.XXXXXX", store->directory) < 0) {return -1;}
+
+	upload->fd = mkstemp(upload->path);
+	if (upload->fd < 0) {free(upload->path); return -1;}
+	upload->result = OTP_SUCCESS;
+
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_keyUploadWrite(struct OTP_KeyUpload* upload, const char* data, size_t length)
+ *  Checks and stores the next bytes of a key. A bad byte makes the
+ *  commit refuse the key; the rest of the upload is still taken in.
+ * Arguments:
+ * 	struct OTP_KeyUpload* upload - the upload
+ *  const char* data - the key bytes
+ *  size_t length - the number of bytes
+ * Returns:
+ * 	OTP_SUCCESS, or the OTP_ERR code the key will be refused with
+*********************************************************************/
+int OTP_keyUploadWrite(struct OTP_KeyUpload* upload, const char* data, size_t length)
+{
+	if (upload->result == OTP_SUCCESS)
+	{
+		// Only a newline ending the key may follow its symbols
+		int ended = upload->usable < upload->length;
+		size_t valid = OTP_validateBuffer(upload->mode, data, length);
+		const char* newline = ended || upload->mode == OTP_MODE_RAW ? NULL : memchr(data, '\n', valid);
+		size_t symbols = ended ? 0 : newline != NULL ? (size_t) (newline - data) : valid;
+		size_t accepted = symbols + (newline != NULL);
+
+		if (accepted < length)
+		{
+			upload->result = OTP_ERR_BADKEY;
+			upload->badOffset = upload->length + accepted;
+		}
+		else if (_writeAt(upload->fd, data, length, OTP_KEY_HEADER + upload->length) < 0)
+		{
+			upload->result = OTP_ERR_FILE;
+		}
+		upload->usable += symbols;
+	}
+	upload->length += length;
+
+	return upload->result;
+}
+
+/*********************************************************************
+ * int OTP_keyUploadCommit(struct OTP_KeyStore* store, struct OTP_KeyUpload* upload, unsigned long* keyID, size_t* badOffset)
+ *  Finishes an upload, adding the key to the store under a new ID
+ *  if it was good. Either way the upload is over afterwards.
+ * Arguments:
+ * 	struct OTP_KeyStore* store - the store
+ *  struct OTP_KeyUpload* upload - the upload
+ *  unsigned long* keyID - where the new key's ID is stored
+ *  size_t* badOffset - where the offset of a bad byte is stored
+ * Returns:
+ * 	OTP_SUCCESS, or the OTP_ERR code the key was refused with
+*********************************************************************/
+int OTP_keyUploadCommit(struct OTP_KeyStore* store, struct OTP_KeyUpload* upload, unsigned long* keyID, size_t* badOffset)
+{
+	struct OTP_KeyHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OTP_KEY_MAGIC, sizeof(OTP_KEY_MAGIC));
+	header.length = upload->usable;
+	header.consumed = 0;
+	header.mode = upload->mode;
+
+	// The key must be on disk before it has a name, so a crash can't
+	// leave an ID pointing at half a key
+	int result = upload->result;
+	if (result == OTP_SUCCESS && (_writeAt(upload->fd, (const char*) &header, sizeof(header), 0) < 0 || fsync(upload->fd) < 0))
+	{
+		result = OTP_ERR_FILE;
+	}
+
+	// Link it in under the next free ID; IDs taken by keys from before
+	// the counter was lost are skipped
+	while (result == OTP_SUCCESS)
+	{
+		char* path;
+		*keyID = __atomic_add_fetch(store->nextID, 1, __ATOMIC_ACQ_REL);
+		if (*keyID >= OTP_KEYS_MAX || asprintf(&path, "%s/%lu.key", store->directory, *keyID) < 0) {result = OTP_ERR_FILE; break;}
+		int linked = link(upload->path, path);
+		free(path);
+		if (linked == 0) {break;}
+		if (errno != EEXIST) {result = OTP_ERR_FILE;}
+	}
+
+	*badOffset = upload->badOffset;
+	OTP_keyUploadAbort(upload);
+	return result;
+}
+
+/*********************************************************************
+ * int OTP_keyUploadAbort(struct OTP_KeyUpload* upload)
+ *  Drops an upload's temporary file, if one is in progress
+ * Arguments:
+ * 	struct OTP_KeyUpload* upload - the upload
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_keyUploadAbort(struct OTP_KeyUpload* upload)
+{
+	if (upload->fd < 0) {return 0;}
+	close(upload->fd);
+	unlink(upload->path);
+	free(upload->path);
+	upload->fd = -1;
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*********************************************************************
+** Program name:    OTP
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**      These are the key store functions of otp_d: keys uploaded once
+**      and kept in a directory, mapped into memory when requests name
+**      them. This is the header file.
+*********************************************************************/
+#ifndef OTP_KEYS_H
+#define OTP_KEYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define OTP_KEY_HEADER 64			// Bytes ahead of the key in each key file
+#define OTP_KEY_MAGIC "OTPKEY1"
+#define OTP_KEYS_MAX (1024 * 1024)	// Most keys a store hands out IDs for
+
+// The start of each key file, "<id>.key" in the store's directory. The
+// key follows at OTP_KEY_HEADER. Every process serving the store maps
+// the file shared, so consumed is one counter for them all, and only
+// ever grows: an encode claims the range it uses by moving it on.
+struct OTP_KeyHeader {
+	char magic[8];
+	uint64_t length;	// Usable key symbols, without a trailing newline
+	uint64_t consumed;	// Symbols already used to encode
+	uint32_t mode;		// OTP_MODE alphabet the key was checked against
+};
+
+// A stored key, mapped in full
+struct OTP_Key {
+	const char* data;
+	size_t length;
+	int mode;
+	uint64_t* consumed;	// In the shared mapping; use atomically
+	struct OTP_KeyHeader* map;
+	size_t mapLength;
+};
+
+// A directory of keys. Keys are mapped the first time a request names
+// them and stay mapped, found again by ID, until the store is closed.
+struct OTP_KeyStore {
+	char* directory;
+	uint64_t* nextID;	// Shared counter, mapped from the directory's "next" file
+	pthread_mutex_t lock;	// Guards keys across threads
+	struct OTP_Key** keys;	// Indexed by ID, NULL until first used
+	size_t capacity;
+};
+
+// A key being uploaded into a temporary file in the store
+struct OTP_KeyUpload {
+	int fd;				// -1 when no upload is in progress
+	char* path;
+	int mode;
+	size_t length;		// Bytes received so far
+	size_t usable;		// Of those, the symbols before any newline
+	int result;			// OTP_SUCCESS, or why the key will be refused
+	size_t badOffset;
+};
+
+// Key Store Functions
+int OTP_keyStoreOpen(struct OTP_KeyStore* store, const char* directory);
+const struct OTP_Key* OTP_keyStoreGet(struct OTP_KeyStore* store, unsigned long keyID);
+int OTP_keyStoreClose(struct OTP_KeyStore* store);
+int OTP_keyReserve(const struct OTP_Key* key, size_t* offset, size_t length);
+// Upload Functions
+int OTP_keyUploadBegin(struct OTP_KeyStore* store, struct OTP_KeyUpload* upload, int mode);
+int OTP_keyUploadWrite(struct OTP_KeyUpload* upload, const char* data, size_t length);
+int OTP_keyUploadCommit(struct OTP_KeyStore* store, struct OTP_KeyUpload* upload, unsigned long* keyID, size_t* badOffset);
+int OTP_keyUploadAbort(struct OTP_KeyUpload* upload);
+
+#endif
@@ -0,0 +1,1743 @@
+/*********************************************************************
+** Program name:    OTP
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**      These are the server functions of otp_d, and of otp_enc_d and
+**      otp_dec_d built from it: a request session that does no I/O of
+**      its own, and the event loops that drive sessions over sockets.
+*********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "otp_server.h"
+
+/*********************************************************************
+ * int OTP_sessionInit(struct OTP_Session* session, int fd, const struct OTP_Service* service, size_t maxChunk)
+ *  Prepares a session for a newly accepted connection
+ * Arguments:
+ * 	struct OTP_Session* session - the session to prepare
+ *  int fd - the connection, kept only for the driver's use
+ *  const struct OTP_Service* service - what the daemon offers
+ *  size_t maxChunk - the largest chunk size to agree to
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_sessionInit(struct OTP_Session* session, int fd, const struct OTP_Service* service, size_t maxChunk)
+{
+	session->fd = fd;
+	session->state = OTP_SESSION_HELLO;
+	session->service = service;
+	session->decoding = 0;
+	session->mode = OTP_MODE_ALPHA27;
+	session->chunkSize = OTP_HELLO_SIZE;
+	session->maxChunk = maxChunk;
+	OTP_streamInit(&session->stream, OTP_MODE_ALPHA27, 0);
+	OTP_bufferInit(&session->input, 0);
+	session->inputStart = 0;
+	OTP_bufferInit(&session->output, 0);
+	session->outputSent = 0;
+	OTP_bufferInit(&session->control, 0);
+	session->controlSent = 0;
+	session->headerSent = OTP_FRAME_HEADER;
+	session->frameLeft = 0;
+	session->replying = 0;
+	session->stored = NULL;
+	session->storedLeft = 0;
+	session->requestID = 0;
+	session->inRequest = 0;
+	session->requestStart = 0;
+	session->upload.fd = -1;
+
+	return 0;
+}
+
+/*********************************************************************
+ * static void _keepBuffer(struct OTP_Buffer* buffer)
+ *  Empties a buffer for the next request, keeping its memory unless
+ *  a huge request left it holding more than OTP_SESSION_KEEP bytes
+*********************************************************************/
+static void _keepBuffer(struct OTP_Buffer* buffer)
+{
+	if (buffer->capacity > OTP_SESSION_KEEP) {OTP_bufferFree(buffer); return;}
+	buffer->length = 0;
+	if (buffer->data != NULL) {buffer->data[0] = '\0';}
+}
+
+/*********************************************************************
+ * int OTP_sessionReset(struct OTP_Session* session, int fd)
+ *  Readies a finished session for another connection, reusing the
+ *  buffers it already has
+ * Arguments:
+ * 	struct OTP_Session* session - the session to reuse
+ *  int fd - the new connection
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_sessionReset(struct OTP_Session* session, int fd)
+{
+	struct OTP_Buffer input = session->input, output = session->output, control = session->control;
+	OTP_streamFinish(&session->stream);
+	OTP_keyUploadAbort(&session->upload);
+	OTP_sessionInit(session, fd, session->service, session->maxChunk);
+
+	session->input = input;
+	session->output = output;
+	session->control = control;
+	_keepBuffer(&session->input);
+	_keepBuffer(&session->output);
+	_keepBuffer(&session->control);
+
+	return 0;
+}
+
+/*********************************************************************
+ * char* OTP_sessionInputSpace(struct OTP_Session* session, size_t* room)
+ *  Gets room for the driver to receive into, enough for at least one
+ *  whole frame of the agreed size
+ * Arguments:
+ * 	struct OTP_Session* session - the session
+ *  size_t* room - where the number of bytes that fit is stored
+ * Returns:
+ * 	char* - where to receive to, or NULL if out of memory
+*********************************************************************/
+char* OTP_sessionInputSpace(struct OTP_Session* session, size_t* room)
+{
+	char* space = OTP_bufferReserve(&session->input, session->chunkSize + OTP_FRAME_HEADER);
+	// Reserve always leaves a byte for the NUL, which must not be overwritten
+	*room = space != NULL ? session->input.capacity - session->input.length - 1 : 0;
+
+	return space;
+}
+
+/*********************************************************************
+ * static void _sessionControl(struct OTP_Session* session, int opcode, int flags, const char* payload, size_t length)
+ *  Queues a small frame to be sent ahead of any result data
+*********************************************************************/
+static void _sessionControl(struct OTP_Session* session, int opcode, int flags, const char* payload, size_t length)
+{
+	char header[OTP_FRAME_HEADER];
+	OTP_packHeader(header, opcode, flags, length, session->requestID);
+	OTP_bufferAppend(&session->control, header, OTP_FRAME_HEADER);
+	OTP_bufferAppend(&session->control, payload, length);
+}
+
+/*********************************************************************
+ * static int _sessionError(struct OTP_Session* session, int code, size_t offset)
+ *  Answers the request with an ERROR frame in place of the rest of
+ *  its result. A DATA frame part way out is finished first; output
+ *  not yet framed is dropped.
+ * Returns:
+ * 	int - the session's new state
+*********************************************************************/
+static int _sessionError(struct OTP_Session* session, int code, size_t offset)
+{
+	char reply[OTP_ERROR_SIZE];
+	session->output.length = session->outputSent + session->frameLeft;
+	OTP_packError(reply, code, offset);
+	_sessionControl(session, OTP_OP_ERROR, OTP_FLAG_END, reply, OTP_ERROR_SIZE);
+	OTP_statsCount(session->service->stats, OTP_STAT_ERRORS, 1);
+
+	return session->state = OTP_SESSION_REPLY;
+}
+
+/*********************************************************************
+ * static int _sessionFinish(struct OTP_Session* session)
+ *  Ends the result with its END frame once text and key are both in,
+ *  or tells the client where its input went wrong
+ * Returns:
+ * 	int - the session's new state
+*********************************************************************/
+static int _sessionFinish(struct OTP_Session* session)
+{
+	int result = OTP_streamFinish(&session->stream);
+	if (result != OTP_SUCCESS) {return _sessionError(session, result, session->stream.offset);}
+
+	session->replying = 1;
+	return session->state = OTP_SESSION_REPLY;
+}
+
+/*********************************************************************
+ * static void _sessionCheckText(struct OTP_Session* session)
+ *  Fails the stream once the whole text is in if a newline comes
+ *  before its end. The stream would find it too, but only as the key
+ *  reached it, after the result before it had gone out.
+*********************************************************************/
+static void _sessionCheckText(struct OTP_Session* session)
+{
+	struct OTP_Stream* stream = &session->stream;
+	const char* text = stream->pending.data + stream->pendingStart;
+	size_t length = stream->pending.length - stream->pendingStart;
+	const char* newline = length > 0 && session->mode != OTP_MODE_RAW ? memchr(text, '\n', length) : NULL;
+	if (newline != NULL && newline + 1 < text + length)
+	{
+		stream->offset += newline - text;
+		stream->result = OTP_ERR_BADTEXT;
+	}
+}
+
+/*********************************************************************
+ * static int _sessionStats(struct OTP_Session* session)
+ *  Answers a STATS frame with the daemon's metrics, sent as DATA
+ * Returns:
+ * 	int - the session's new state
+*********************************************************************/
+static int _sessionStats(struct OTP_Session* session)
+{
+	struct OTP_Stats* stats = session->service->stats;
+	char* text = OTP_bufferReserve(&session->output, OTP_STATS_TEXT);
+	if (text == NULL) {return session->state = OTP_SESSION_FAILED;}
+
+	session->output.length += stats != NULL ? OTP_statsFormat(stats, text, OTP_STATS_TEXT) : 0;
+	session->replying = 1;
+	return session->state = OTP_SESSION_REPLY;
+}
+
+/*********************************************************************
+ * static int _sessionKeyRef(struct OTP_Session* session, const struct OTP_Frame* frame, const char* payload)
+ *  Completes a request whose key is in the store. The text is all
+ *  held in the stream by now, so the key is fed to it straight from
+ *  the store's mapping, a chunk at a time as the result goes out,
+ *  never copied into the session.
+ * Returns:
+ * 	int - the session's new state
+*********************************************************************/
+static int _sessionKeyRef(struct OTP_Session* session, const struct OTP_Frame* frame, const char* payload)
+{
+	struct OTP_Stream* stream = &session->stream;
+	struct OTP_KeyStore* keys = session->service->keys;
+	const struct OTP_Key* key = NULL;
+	unsigned long keyID;
+	size_t offset;
+	char reply[OTP_KEYREF_SIZE];
+
+	// A stored key stands in for the whole key, so it comes alone
+	int keyed = stream->offset > 0 || (stream->pendingIsKey && stream->pending.length > stream->pendingStart);
+	if (!(frame->flags & OTP_FLAG_END) || keyed || OTP_parseKeyRef(payload, frame->length, &keyID, &offset) < 0)
+	{
+		return session->state = OTP_SESSION_FAILED;
+	}
+	if (keys != NULL) {key = OTP_keyStoreGet(keys, keyID);}
+	if (key == NULL) {return _sessionError(session, OTP_ERR_NOKEY, 0);}
+	if (key->mode != session->mode) {return _sessionError(session, OTP_ERR_BADKEY, 0);}
+
+	// Don't claim any pad for a text the stream has refused already
+	if (stream->result != OTP_SUCCESS) {return _sessionError(session, stream->result, stream->offset);}
+
+	// Every symbol but the text's trailing newline takes a symbol of the key
+	size_t length = stream->pending.length - stream->pendingStart;
+	int newline = length > 0 && session->mode != OTP_MODE_RAW && stream->pending.data[stream->pending.length - 1] == '\n';
+	size_t needed = length - newline;
+
+	// Encoding claims its range of the key for good; decoding reads
+	// back a range that an encode claimed
+	int result = OTP_SUCCESS;
+	if (!session->decoding) {result = OTP_keyReserve(key, &offset, needed);}
+	else if (offset == OTP_KEY_NEXT || offset > key->length || needed > key->length - offset) {result = OTP_ERR_KEYSHORT;}
+	if (result == OTP_ERR_KEYSHORT) {return _sessionError(session, result, offset < key->length ? key->length - offset : 0);}
+	if (result != OTP_SUCCESS) {return _sessionError(session, result, 0);}
+
+	session->stored = key->data + offset;
+	session->storedLeft = needed;
+
+	// Tell the encoding client where its pad started, so it can be
+	// named again to decode
+	if (!session->decoding)
+	{
+		OTP_packKeyRef(reply, keyID, offset);
+		_sessionControl(session, OTP_OP_KEYREF, 0, reply, OTP_KEYREF_SIZE);
+	}
+	return session->state = OTP_SESSION_REPLY;
+}
+
+/*********************************************************************
+ * static void _sessionProduce(struct OTP_Session* session)
+ *  Feeds the stream the next chunk of a stored key, and finishes the
+ *  request once the key it needs is used up
+*********************************************************************/
+static void _sessionProduce(struct OTP_Session* session)
+{
+	struct OTP_Stream* stream = &session->stream;
+	size_t length = session->storedLeft < session->chunkSize ? session->storedLeft : session->chunkSize;
+	size_t produced;
+
+	// Each byte of key brings at most a byte out, and the newline one more
+	char* end = OTP_bufferReserve(&session->output, length + 1);
+	if (end == NULL) {session->stored = NULL; session->state = OTP_SESSION_FAILED; return;}
+	int result = OTP_streamUpdate(stream, NULL, 0, session->stored, length, end, &produced);
+	session->output.length += produced;
+	session->stored += length;
+	session->storedLeft = result == OTP_SUCCESS ? session->storedLeft - length : 0;
+	if (session->storedLeft > 0) {return;}
+
+	// The newline takes no key, but the stream needs a byte under it
+	if (stream->pending.length > stream->pendingStart)
+	{
+		OTP_streamUpdate(stream, NULL, 0, "\n", 1, end + produced, &produced);
+		session->output.length += produced;
+	}
+	session->stored = NULL;
+	_sessionFinish(session);
+}
+
+/*********************************************************************
+ * static int _sessionFrame(struct OTP_Session* session, const struct OTP_Frame* frame, const char* payload)
+ *  Advances the session with one whole frame from the client
+ * Returns:
+ * 	int - the session's new state
+*********************************************************************/
+static int _sessionFrame(struct OTP_Session* session, const struct OTP_Frame* frame, const char* payload)
+{
+	char reply[OTP_KEYREF_SIZE];	// Room for any control payload
+	size_t produced;
+
+	switch (session->state)
+	{
+		case OTP_SESSION_HELLO:
+		{
+			// A client that only wants the metrics needs no handshake,
+			// and is done once it has them
+			if (frame->opcode == OTP_OP_STATS)
+			{
+				session->chunkSize = OTP_STATS_TEXT;
+				session->requestID = frame->requestID;
+				return _sessionStats(session);
+			}
+
+			int status = 403;
+			if (frame->opcode == OTP_OP_HELLO)
+			{
+				status = OTP_acceptHello(payload, frame->length, session->service->serves, session->maxChunk, &session->decoding, &session->mode, &session->chunkSize);
+			}
+			OTP_packWelcome(reply, status, session->chunkSize);
+			_sessionControl(session, OTP_OP_WELCOME, 0, reply, OTP_WELCOME_SIZE);
+
+			// A refused client only gets the welcome
+			if (status != 200)
+			{
+				OTP_statsCount(session->service->stats, OTP_STAT_REJECTED, 1);
+				return session->state = OTP_SESSION_REPLY;
+			}
+			OTP_streamInit(&session->stream, session->mode, session->decoding);
+			return session->state = OTP_SESSION_TEXT;
+		}
+		case OTP_SESSION_TEXT:
+		case OTP_SESSION_KEY:
+		{
+			int isKey = session->state == OTP_SESSION_KEY;
+
+			// The first frame of a request names it; the rest must match
+			if (!session->inRequest)
+			{
+				session->requestID = frame->requestID;
+				session->inRequest = 1;
+				if (frame->opcode == OTP_OP_STATS) {return _sessionStats(session);}
+				session->requestStart = OTP_statsNow();
+
+				// A KEYPUT starts an upload instead of a request
+				if (frame->opcode == OTP_OP_KEYPUT)
+				{
+					OTP_keyUploadBegin(session->service->keys, &session->upload, session->mode);
+					session->state = OTP_SESSION_UPLOAD;
+					return _sessionFrame(session, frame, payload);
+				}
+			}
+			if (frame->requestID != session->requestID) {return session->state = OTP_SESSION_FAILED;}
+			if (isKey && frame->opcode == OTP_OP_KEYREF) {return _sessionKeyRef(session, frame, payload);}
+			if (frame->opcode != (isKey ? OTP_OP_KEY : OTP_OP_TEXT)) {return session->state = OTP_SESSION_FAILED;}
+
+			// Make room for the output, then feed the stream. The text
+			// all comes before its key, so only a key frame brings
+			// output, at most a byte for each of its own.
+			char* end = OTP_bufferReserve(&session->output, isKey ? frame->length : 0);
+			if (end == NULL) {return session->state = OTP_SESSION_FAILED;}
+			if (isKey)
+			{
+				OTP_streamUpdate(&session->stream, NULL, 0, payload, frame->length, end, &produced);
+			}
+			else
+			{
+				OTP_streamUpdate(&session->stream, payload, frame->length, NULL, 0, end, &produced);
+			}
+			session->output.length += produced;
+			if (!(frame->flags & OTP_FLAG_END)) {return session->state;}
+			if (!isKey)
+			{
+				_sessionCheckText(session);
+				return session->state = OTP_SESSION_KEY;
+			}
+
+			// Both files are in
+			return _sessionFinish(session);
+		}
+		case OTP_SESSION_UPLOAD:
+		{
+			if (frame->opcode != OTP_OP_KEYPUT || frame->requestID != session->requestID) {return session->state = OTP_SESSION_FAILED;}
+
+			// A key that can't be stored is still read to its end, so
+			// the refusal answers the whole upload
+			OTP_keyUploadWrite(&session->upload, payload, frame->length);
+			if (!(frame->flags & OTP_FLAG_END)) {return session->state;}
+
+			unsigned long keyID;
+			size_t badOffset;
+			int result = OTP_keyUploadCommit(session->service->keys, &session->upload, &keyID, &badOffset);
+			if (result != OTP_SUCCESS) {return _sessionError(session, result, badOffset);}
+			OTP_packKeyRef(reply, keyID, 0);
+			_sessionControl(session, OTP_OP_KEYREF, OTP_FLAG_END, reply, OTP_KEYREF_SIZE);
+			return session->state = OTP_SESSION_REPLY;
+		}
+		default:
+		{
+			// Nothing more is expected once the key is complete
+			return session->state = OTP_SESSION_FAILED;
+		}
+	}
+}
+
+/*********************************************************************
+ * static int _sessionFraming(const struct OTP_Session* session)
+ *  Tells whether a DATA frame is part way out
+*********************************************************************/
+static int _sessionFraming(const struct OTP_Session* session)
+{
+	return session->headerSent < OTP_FRAME_HEADER || session->frameLeft > 0;
+}
+
+/*********************************************************************
+ * static int _sessionDrained(const struct OTP_Session* session)
+ *  Tells whether all of the output made so far has been sent
+*********************************************************************/
+static int _sessionDrained(const struct OTP_Session* session)
+{
+	return !_sessionFraming(session) && session->outputSent == session->output.length;
+}
+
+/*********************************************************************
+ * static int _sessionParse(struct OTP_Session* session)
+ *  Handles whole frames from the input until a reply is due, or until
+ *  one brings output, which must go before any more is made. Frames
+ *  held back wait in the input until it has been sent.
+ * Returns:
+ * 	int - the session's new state
+*********************************************************************/
+static int _sessionParse(struct OTP_Session* session)
+{
+	while (session->state < OTP_SESSION_REPLY && _sessionDrained(session) && session->input.length - session->inputStart >= OTP_FRAME_HEADER)
+	{
+		struct OTP_Frame frame;
+		const char* header = session->input.data + session->inputStart;
+		if (OTP_unpackHeader(header, &frame) < 0 || frame.length > session->chunkSize) {session->state = OTP_SESSION_FAILED; break;}
+		if (session->input.length - session->inputStart < OTP_FRAME_HEADER + frame.length) {break;}
+
+		session->inputStart += OTP_FRAME_HEADER + frame.length;
+		_sessionFrame(session, &frame, header + OTP_FRAME_HEADER);
+
+		// Time how long the request took to come in
+		if (session->state == OTP_SESSION_REPLY && session->requestStart != 0)
+		{
+			session->replyStart = OTP_statsNow();
+			OTP_statsRecord(session->service->stats, OTP_STAT_RECEIVE, session->replyStart - session->requestStart);
+		}
+	}
+
+	if (session->state == OTP_SESSION_FAILED) {OTP_statsCount(session->service->stats, OTP_STAT_FAILED, 1);}
+
+	// Slide any partial frame back to the front
+	if (session->inputStart > 0)
+	{
+		session->input.length -= session->inputStart;
+		memmove(session->input.data, session->input.data + session->inputStart, session->input.length);
+		session->inputStart = 0;
+	}
+	return session->state;
+}
+
+/*********************************************************************
+ * int OTP_sessionReceived(struct OTP_Session* session, size_t length)
+ *  Tells the session that bytes were received into its input space,
+ *  and handles every whole frame now available
+ * Arguments:
+ * 	struct OTP_Session* session - the session
+ *  size_t length - the number of bytes received
+ * Returns:
+ * 	int - the session's new state
+*********************************************************************/
+int OTP_sessionReceived(struct OTP_Session* session, size_t length)
+{
+	session->input.length += length;
+	OTP_statsCount(session->service->stats, OTP_STAT_BYTES_IN, length);
+
+	return _sessionParse(session);
+}
+
+/*********************************************************************
+ * int OTP_sessionOutput(struct OTP_Session* session, struct iovec pieces[])
+ *  Gets the bytes the session wants sent next. Result data goes out
+ *  straight from the codec's output as soon as there is any, framed
+ *  as it is sent; only the frame that ends the result carries END.
+ * Arguments:
+ * 	struct OTP_Session* session - the session
+ *  struct iovec pieces[] - where up to two buffers to send are stored
+ * Returns:
+ * 	int - the number of buffers, 0 if there is nothing to send
+*********************************************************************/
+int OTP_sessionOutput(struct OTP_Session* session, struct iovec pieces[])
+{
+	// A DATA frame part way out is finished, then control frames go
+	if (!_sessionFraming(session))
+	{
+		if (session->controlSent < session->control.length)
+		{
+			pieces[0].iov_base = session->control.data + session->controlSent;
+			pieces[0].iov_len = session->control.length - session->controlSent;
+			return 1;
+		}
+
+		// A stored key makes its next chunk once the last has gone
+		if (session->stored != NULL && session->outputSent == session->output.length)
+		{
+			_sessionProduce(session);
+			return OTP_sessionOutput(session, pieces);
+		}
+
+		// Start the next DATA frame
+		size_t left = session->output.length - session->outputSent;
+		if (left == 0 && !session->replying) {return 0;}
+		session->frameLeft = left < session->chunkSize ? left : session->chunkSize;
+		int last = session->replying && session->frameLeft == left;
+		if (last) {session->replying = 0;}
+		OTP_packHeader(session->header, OTP_OP_DATA, last ? OTP_FLAG_END : 0, session->frameLeft, session->requestID);
+		session->headerSent = 0;
+	}
+
+	int count = 0;
+	if (session->headerSent < OTP_FRAME_HEADER)
+	{
+		pieces[count].iov_base = session->header + session->headerSent;
+		pieces[count++].iov_len = OTP_FRAME_HEADER - session->headerSent;
+	}
+	if (session->frameLeft > 0)
+	{
+		pieces[count].iov_base = session->output.data + session->outputSent;
+		pieces[count++].iov_len = session->frameLeft;
+	}
+	return count;
+}
+
+/*********************************************************************
+ * static void _sessionNext(struct OTP_Session* session)
+ *  Readies a session that has sent its reply for the next request on
+ *  the connection, keeping its buffers
+*********************************************************************/
+static void _sessionNext(struct OTP_Session* session)
+{
+	OTP_streamInit(&session->stream, session->mode, session->decoding);
+	session->output.length = 0;
+	session->outputSent = 0;
+	session->stored = NULL;
+	session->control.length = 0;
+	session->controlSent = 0;
+	session->headerSent = OTP_FRAME_HEADER;
+	session->frameLeft = 0;
+	session->inRequest = 0;
+	session->requestStart = 0;
+	session->state = OTP_SESSION_TEXT;
+}
+
+/*********************************************************************
+ * int OTP_sessionSent(struct OTP_Session* session, size_t length)
+ *  Tells the session how many of the bytes from OTP_sessionOutput
+ *  were sent
+ * Arguments:
+ * 	struct OTP_Session* session - the session
+ *  size_t length - the number of bytes sent
+ * Returns:
+ * 	int - the session's new state
+*********************************************************************/
+int OTP_sessionSent(struct OTP_Session* session, size_t length)
+{
+	size_t part;
+	OTP_statsCount(session->service->stats, OTP_STAT_BYTES_OUT, length);
+
+	// OTP_sessionOutput offers either the rest of a DATA frame, or
+	// control frames only
+	if (_sessionFraming(session))
+	{
+		part = OTP_FRAME_HEADER - session->headerSent;
+		part = length < part ? length : part;
+		session->headerSent += part;
+		length -= part;
+
+		part = length < session->frameLeft ? length : session->frameLeft;
+		session->outputSent += part;
+		session->frameLeft -= part;
+	}
+	else
+	{
+		part = session->control.length - session->controlSent;
+		part = length < part ? length : part;
+		session->controlSent += part;
+	}
+
+	// Output that has all gone leaves the buffer empty for more
+	int drained = _sessionDrained(session);
+	if (drained) {session->output.length = session->outputSent = 0;}
+
+	if (session->state == OTP_SESSION_REPLY && session->controlSent == session->control.length && drained && !session->replying && session->stored == NULL)
+	{
+		// A refused hello ends the connection; a reply readies the
+		// session for the next request, which may already be waiting
+		if (!session->inRequest) {return session->state = OTP_SESSION_DONE;}
+		if (session->requestStart != 0)
+		{
+			uint64_t now = OTP_statsNow();
+			OTP_statsRecord(session->service->stats, OTP_STAT_SEND, now - session->replyStart);
+			OTP_statsRecord(session->service->stats, OTP_STAT_TOTAL, now - session->requestStart);
+			OTP_statsCount(session->service->stats, OTP_STAT_REQUESTS, 1);
+		}
+		_sessionNext(session);
+		return _sessionParse(session);
+	}
+	// Frames held back while the output went can be handled now
+	if (session->state < OTP_SESSION_REPLY) {return _sessionParse(session);}
+	return session->state;
+}
+
+/*********************************************************************
+ * int OTP_sessionHangup(struct OTP_Session* session)
+ *  Tells the session the client closed its end of the connection
+ * Arguments:
+ * 	struct OTP_Session* session - the session
+ * Returns:
+ * 	int - OTP_SESSION_DONE if the client left between requests,
+ *  OTP_SESSION_FAILED if it left one unfinished
+*********************************************************************/
+int OTP_sessionHangup(struct OTP_Session* session)
+{
+	int idle = session->state == OTP_SESSION_TEXT && !session->inRequest && session->input.length == 0;
+	if (session->state == OTP_SESSION_DONE || idle) {return session->state = OTP_SESSION_DONE;}
+	if (session->state != OTP_SESSION_FAILED) {OTP_statsCount(session->service->stats, OTP_STAT_FAILED, 1);}
+	return session->state = OTP_SESSION_FAILED;
+}
+
+/*********************************************************************
+ * int OTP_sessionFree(struct OTP_Session* session)
+ *  Frees a session's memory. The driver closes the connection.
+ * Arguments:
+ * 	struct OTP_Session* session - the session
+ * Returns:
+ * 	0 on success
+*********************************************************************/
+int OTP_sessionFree(struct OTP_Session* session)
+{
+	OTP_streamFinish(&session->stream);
+	OTP_keyUploadAbort(&session->upload);
+	OTP_bufferFree(&session->input);
+	OTP_bufferFree(&session->output);
+	OTP_bufferFree(&session->control);
+
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_serveSession(struct OTP_Session* session)
+ *  Runs a session over its blocking connection, answering requests
+ *  until the client hangs up
+ * Arguments:
+ * 	struct OTP_Session* session - the session, with its connection
+ * Returns:
+ * 	0 if the client left between requests, -1 if the connection
+ *  failed or the client broke protocol
+*********************************************************************/
+int OTP_serveSession(struct OTP_Session* session)
+{
+	struct iovec pieces[2];
+	int count;
+	while (1)
+	{
+		// Send whatever the session has queued, the WELCOME included
+		while ((count = OTP_sessionOutput(session, pieces)) > 0)
+		{
+			size_t length = pieces[0].iov_len + (count > 1 ? pieces[1].iov_len : 0);
+			if (OTP_sendAllv(session->fd, pieces, count) < 0) {return -1;}
+			OTP_sessionSent(session, length);
+		}
+		if (session->state >= OTP_SESSION_DONE) {break;}
+
+		size_t room;
+		char* space = OTP_sessionInputSpace(session, &room);
+		if (space == NULL) {return -1;}
+		ssize_t charsRead = recv(session->fd, space, room, 0);
+		if (charsRead < 0 && errno == EINTR) {continue;}
+		if (charsRead < 0) {return -1;}
+		if (charsRead == 0) {OTP_sessionHangup(session); break;}
+		OTP_sessionReceived(session, charsRead);
+	}
+	return session->state == OTP_SESSION_DONE ? 0 : -1;
+}
+
+// A worker's queue of accepted connections. The worker and idle workers
+// stealing from it all take the oldest from the head, so a connection
+// stuck behind a long request is the first to be rescued. Each queue
+// has its own lock, so workers only contend when stealing.
+struct _WorkQueue {
+	pthread_mutex_t lock;
+	int* connections;	// Ring of connection descriptors
+	size_t head;
+	size_t count;
+	size_t capacity;
+};
+
+struct _ThreadPool {
+	struct _WorkQueue* queues;
+	int threads;
+	const struct OTP_Service* service;
+	sem_t queued;		// Counts connections waiting in any queue
+	int admitted;		// Connections queued or being served
+};
+
+struct _WorkerArgs {
+	struct _ThreadPool* pool;
+	int index;
+};
+
+/*********************************************************************
+ * static void _queuePush(struct _WorkQueue* queue, int connection)
+ *  Adds a connection to the tail of a queue, growing it if full
+*********************************************************************/
+static void _queuePush(struct _WorkQueue* queue, int connection)
+{
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count == queue->capacity)
+	{
+		size_t capacity = queue->capacity ? queue->capacity * 2 : OTP_BUFFERSIZE;
+		int* grown = malloc(capacity * sizeof(int));
+		size_t index;
+		for (index = 0; index < queue->count; index++)
+		{
+			grown[index] = queue->connections[(queue->head + index) % queue->capacity];
+		}
+		free(queue->connections);
+		queue->connections = grown;
+		queue->head = 0;
+		queue->capacity = capacity;
+	}
+	queue->connections[(queue->head + queue->count++) % queue->capacity] = connection;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/*********************************************************************
+ * static int _queueTake(struct _WorkQueue* queue)
+ *  Takes the oldest connection, for its own worker or a thief
+ * Returns:
+ * 	int - the connection, or -1 if the queue is empty
+*********************************************************************/
+static int _queueTake(struct _WorkQueue* queue)
+{
+	int connection = -1;
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count > 0)
+	{
+		queue->count--;
+		connection = queue->connections[queue->head];
+		queue->head = (queue->head + 1) % queue->capacity;
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return connection;
+}
+
+/*********************************************************************
+ * static void* _threadWorker(void* arguments)
+ *  Serves connections from this thread's own queue, stealing from the
+ *  others whenever it runs dry, with one reusable session per thread
+*********************************************************************/
+static void* _threadWorker(void* arguments)
+{
+	struct _WorkerArgs* worker = arguments;
+	struct _ThreadPool* pool = worker->pool;
+
+	// Keep to one core, where this thread's buffers stay warm
+	cpu_set_t cores;
+	CPU_ZERO(&cores);
+	CPU_SET(worker->index % sysconf(_SC_NPROCESSORS_ONLN), &cores);
+	pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+
+	struct OTP_Session session;
+	OTP_sessionInit(&session, -1, pool->service, OTP_CHUNK_MAX);
+
+	while (1)
+	{
+		// Wait for a connection to be queued somewhere, then find it
+		while (sem_wait(&pool->queued) < 0);
+		int connection = _queueTake(&pool->queues[worker->index]);
+		int offset;
+		for (offset = 1; connection < 0; offset++)
+		{
+			connection = _queueTake(&pool->queues[(worker->index + offset) % pool->threads]);
+		}
+
+		OTP_statsGauge(pool->service->stats, OTP_STAT_QUEUED, -1);
+		OTP_statsConnection(pool->service->stats, 1);
+		OTP_sessionReset(&session, connection);
+		OTP_serveSession(&session);
+		close(connection);
+		OTP_statsConnection(pool->service->stats, 0);
+		__atomic_fetch_sub(&pool->admitted, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/*********************************************************************
+ * int OTP_runThreads(const int listenFDs[], int listeners, int threads, const struct OTP_Service* service)
+ *  Serves connections on a pool of threads, one per core unless told
+ *  otherwise. Connections are dealt out to the threads' own queues,
+ *  and a thread that runs out of work steals from the others, so a
+ *  huge request doesn't hold up the small ones queued behind it. The
+ *  threads are the limit on connections served at once; past the
+ *  service's queue of waiting ones, new connections are refused busy.
+ * Arguments:
+ * 	const int listenFDs[] - the bound, listening sockets
+ *  int listeners - the number of listening sockets
+ *  int threads - the number of threads, or 0 for one per core
+ *  const struct OTP_Service* service - what the daemon offers
+ * Returns:
+ * 	Does not return unless accept fails
+*********************************************************************/
+int OTP_runThreads(const int listenFDs[], int listeners, int threads, const struct OTP_Service* service)
+{
+	if (threads <= 0) {threads = sysconf(_SC_NPROCESSORS_ONLN);}
+	int queue = service->queue >= 0 ? service->queue : OTP_QUEUE_DEFAULT;
+	signal(SIGPIPE, SIG_IGN); // A client hanging up must not take the process down
+
+	struct _ThreadPool pool;
+	pool.queues = calloc(threads, sizeof(struct _WorkQueue));
+	pool.threads = threads;
+	pool.service = service;
+	pool.admitted = 0;
+	sem_init(&pool.queued, 0, 0);
+
+	struct _WorkerArgs* workers = calloc(threads, sizeof(struct _WorkerArgs));
+	int index;
+	for (index = 0; index < threads; index++)
+	{
+		pthread_mutex_init(&pool.queues[index].lock, NULL);
+		workers[index].pool = &pool;
+		workers[index].index = index;
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, _threadWorker, &workers[index]) != 0) OTP_fatal("ERROR starting thread");
+		pthread_detach(thread);
+	}
+
+	// Deal accepted connections out to the threads in turn
+	for (index = 0; ; index = (index + 1) % threads)
+	{
+		int establishedConnectionFD = OTP_acceptAny(listenFDs, listeners, -1);
+		if (establishedConnectionFD < 0) {continue;}
+
+		// Every thread is busy and enough are already waiting for one
+		int admitted = __atomic_load_n(&pool.admitted, __ATOMIC_RELAXED);
+		if (admitted >= threads + queue) {OTP_refuseBusy(service, establishedConnectionFD, (admitted - threads) / threads); continue;}
+		__atomic_fetch_add(&pool.admitted, 1, __ATOMIC_RELAXED);
+		OTP_statsGauge(service->stats, OTP_STAT_QUEUED, 1);
+		_queuePush(&pool.queues[index], establishedConnectionFD);
+		sem_post(&pool.queued);
+	}
+	return 0;
+}
+
+// A session along with the epoll events it is registered for
+struct _ReactorConnection {
+	struct OTP_Session session;
+	unsigned events;
+};
+
+static int _reactorOpen = 0;	// Connections this process's reactor is serving
+static int _spareFD = -1;		// Given up to turn a connection away when out of descriptors
+
+/*********************************************************************
+ * static void _refuseSpare(int listenSocketFD, const struct OTP_Service* service)
+ *  Called when accept fails for want of a descriptor. Left in the
+ *  backlog, the connection would keep the listener readable and the
+ *  event loop spinning, so this frees the spare descriptor, accepts
+ *  the connection with it and refuses it busy, then takes the spare
+ *  back. Only one connection goes each time, the rest waiting for the
+ *  listener's next event.
+*********************************************************************/
+static void _refuseSpare(int listenSocketFD, const struct OTP_Service* service)
+{
+	// The uring's listeners block, so check there is one to take
+	struct pollfd ready = {listenSocketFD, POLLIN, 0};
+	if (_spareFD < 0 || poll(&ready, 1, 0) != 1) {return;}
+	close(_spareFD);
+	int establishedConnectionFD = accept4(listenSocketFD, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (establishedConnectionFD >= 0) {OTP_refuseBusy(service, establishedConnectionFD, 0);}
+	_spareFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+/*********************************************************************
+ * static void _closeConnection(int epollFD, struct _ReactorConnection* connection)
+ *  Drops a connection from the reactor and frees it
+*********************************************************************/
+static void _closeConnection(int epollFD, struct _ReactorConnection* connection)
+{
+	epoll_ctl(epollFD, EPOLL_CTL_DEL, connection->session.fd, NULL);
+	close(connection->session.fd);
+	OTP_statsConnection(connection->session.service->stats, 0);
+	OTP_sessionFree(&connection->session);
+	free(connection);
+	_reactorOpen--;
+}
+
+/*********************************************************************
+ * static void _acceptConnections(int epollFD, int listenSocketFD, const struct OTP_Service* service)
+ *  Accepts every pending connection on a listening socket and
+ *  registers it for reading, or refuses it busy if the service's
+ *  limit is already being served
+*********************************************************************/
+static void _acceptConnections(int epollFD, int listenSocketFD, const struct OTP_Service* service)
+{
+	int establishedConnectionFD;
+	while ((establishedConnectionFD = accept4(listenSocketFD, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		int noDelay = 1; // Don't hold the small end-of-result frames back
+		setsockopt(establishedConnectionFD, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		if (service->limit > 0 && _reactorOpen >= service->limit) {OTP_refuseBusy(service, establishedConnectionFD, 0); continue;}
+
+		struct _ReactorConnection* connection = malloc(sizeof(struct _ReactorConnection));
+		_reactorOpen++;
+		OTP_sessionInit(&connection->session, establishedConnectionFD, service, OTP_CHUNK_DEFAULT);
+		OTP_statsConnection(service->stats, 1);
+		connection->events = EPOLLIN;
+
+		struct epoll_event event = {EPOLLIN, {.ptr = connection}};
+		if (epoll_ctl(epollFD, EPOLL_CTL_ADD, establishedConnectionFD, &event) < 0) {_closeConnection(epollFD, connection);}
+	}
+	// Out of descriptors: turn the next one away rather than spin on it
+	if (errno == EMFILE || errno == ENFILE)
+	{
+		perror("SERVER: accept");
+		_refuseSpare(listenSocketFD, service);
+	}
+}
+
+/*********************************************************************
+ * static int _serviceConnection(int epollFD, struct _ReactorConnection* connection)
+ *  Sends whatever the session has ready and reads whatever the client
+ *  has sent, in turn, without blocking on either
+ * Returns:
+ * 	0 if the connection stays open, -1 once it is closed
+*********************************************************************/
+static int _serviceConnection(int epollFD, struct _ReactorConnection* connection)
+{
+	struct OTP_Session* session = &connection->session;
+	struct iovec pieces[2];
+	int count;
+
+	while (1)
+	{
+		// Send until the session is done or the socket is full
+		while ((count = OTP_sessionOutput(session, pieces)) > 0)
+		{
+			ssize_t charsWritten = writev(session->fd, pieces, count);
+			if (charsWritten >= 0) {OTP_sessionSent(session, charsWritten); continue;}
+			if (errno == EINTR) {continue;}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {break;}
+			session->state = OTP_SESSION_FAILED;
+			break;
+		}
+		// Read on only once that has all gone, so a client that
+		// doesn't read its results can't pile them up here
+		if (count > 0 || session->state >= OTP_SESSION_REPLY) {break;}
+
+		size_t room;
+		char* space = OTP_sessionInputSpace(session, &room);
+		if (space == NULL) {_closeConnection(epollFD, connection); return -1;}
+		ssize_t charsRead = recv(session->fd, space, room, 0);
+		if (charsRead > 0) {OTP_sessionReceived(session, charsRead); continue;}
+		if (charsRead < 0 && errno == EINTR) {continue;}
+		if (charsRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {break;}
+		// The client hung up or the connection failed
+		_closeConnection(epollFD, connection);
+		return -1;
+	}
+	if (session->state == OTP_SESSION_DONE || session->state == OTP_SESSION_FAILED)
+	{
+		_closeConnection(epollFD, connection);
+		return -1;
+	}
+
+	// Only ask to hear about writability while something is waiting
+	unsigned events = count > 0 ? EPOLLOUT : EPOLLIN;
+	if (events != connection->events)
+	{
+		struct epoll_event event = {events, {.ptr = connection}};
+		epoll_ctl(epollFD, EPOLL_CTL_MOD, session->fd, &event);
+		connection->events = events;
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_runReactor(const int listenFDs[], int listeners, const struct OTP_Service* service)
+ *  Serves every connection from this one process, driving each
+ *  session through epoll instead of forking per request. Given a
+ *  limit, the service refuses connections past it busy.
+ * Arguments:
+ * 	const int listenFDs[] - the bound, listening sockets
+ *  int listeners - the number of listening sockets
+ *  const struct OTP_Service* service - what the daemon offers
+ * Returns:
+ * 	Does not return unless epoll fails
+*********************************************************************/
+int OTP_runReactor(const int listenFDs[], int listeners, const struct OTP_Service* service)
+{
+	signal(SIGPIPE, SIG_IGN); // A client hanging up must not take the process down
+
+	// Allow as many connections as the hard limit on descriptors does
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	_spareFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	int epollFD = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFD < 0) OTP_fatal("ERROR creating epoll");
+	int index;
+	for (index = 0; index < listeners; index++)
+	{
+		fcntl(listenFDs[index], F_SETFL, fcntl(listenFDs[index], F_GETFL) | O_NONBLOCK);
+		struct epoll_event event = {EPOLLIN, {.ptr = NULL}};
+		if (epoll_ctl(epollFD, EPOLL_CTL_ADD, listenFDs[index], &event) < 0) OTP_fatal("ERROR watching socket");
+	}
+
+	struct epoll_event events[OTP_REACTOR_EVENTS];
+	while (1)
+	{
+		int count = epoll_wait(epollFD, events, OTP_REACTOR_EVENTS, -1);
+		if (count < 0 && errno == EINTR) {continue;}
+		if (count < 0) OTP_fatal("ERROR waiting on epoll");
+
+		for (index = 0; index < count; index++)
+		{
+			if (events[index].data.ptr != NULL) {_serviceConnection(epollFD, events[index].data.ptr); continue;}
+			// A listener is ready; the sockets that aren't just say EAGAIN
+			int listener;
+			for (listener = 0; listener < listeners; listener++) {_acceptConnections(epollFD, listenFDs[listener], service);}
+		}
+	}
+	return 0;
+}
+
+/*********************************************************************
+ * int OTP_listenSocket(const struct sockaddr_in* address, int backlog, int reusePort)
+ *  Creates a socket listening on an address
+ * Arguments:
+ * 	const struct sockaddr_in* address - the address to listen on
+ *  int backlog - the most connections waiting to be accepted
+ *  int reusePort - 1 to share the port with other SO_REUSEPORT
+ *  	sockets, the kernel spreading new connections across them
+ * Returns:
+ * 	int - the listening socket
+*********************************************************************/
+int OTP_listenSocket(const struct sockaddr_in* address, int backlog, int reusePort)
+{
+	int listenSocketFD = socket(AF_INET, SOCK_STREAM, 0); // Create the socket
+	if (listenSocketFD < 0) OTP_fatal("ERROR opening socket");
+	if (reusePort && setsockopt(listenSocketFD, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort)) < 0) OTP_fatal("ERROR sharing port");
+
+	if (bind(listenSocketFD, (const struct sockaddr*) address, sizeof(*address)) < 0) OTP_fatal("ERROR on binding");
+	if (backlog > 0) {listen(listenSocketFD, backlog);}
+
+	return listenSocketFD;
+}
+
+/*********************************************************************
+ * int OTP_listenUnix(const char* path, int backlog)
+ *  Creates a Unix domain stream socket listening at a path. A socket
+ *  left at the path by a daemon that is no longer running is replaced;
+ *  one that a live daemon still answers on is not.
+ * Arguments:
+ * 	const char* path - where the socket goes in the file system
+ *  int backlog - the most connections waiting to be accepted
+ * Returns:
+ * 	int - the listening socket
+*********************************************************************/
+int OTP_listenUnix(const char* path, int backlog)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) {fprintf(stderr, "ERROR socket path too long\n"); exit(1);}
+	strcpy(address.sun_path, path);
+
+	int listenSocketFD = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenSocketFD < 0) OTP_fatal("ERROR opening socket");
+
+	// Clear away a stale socket, but never steal a live one
+	if (connect(listenSocketFD, (struct sockaddr*) &address, sizeof(address)) == 0) {fprintf(stderr, "ERROR %s is in use\n", path); exit(1);}
+	if (errno == ECONNREFUSED) {unlink(path);}
+	close(listenSocketFD);
+
+	listenSocketFD = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenSocketFD < 0) OTP_fatal("ERROR opening socket");
+	if (bind(listenSocketFD, (struct sockaddr*) &address, sizeof(address)) < 0) OTP_fatal("ERROR on binding");
+	listen(listenSocketFD, backlog);
+
+	return listenSocketFD;
+}
+
+/*********************************************************************
+ * int OTP_acceptAny(const int listenFDs[], int listeners, int eventFD)
+ *  Waits for a connection on any of the listening sockets and accepts
+ *  it, turning off Nagle's algorithm if it is TCP
+ * Arguments:
+ * 	const int listenFDs[] - the listening sockets
+ *  int listeners - the number of listening sockets
+ *  int eventFD - another descriptor to stop waiting for once it is
+ *  	readable, or -1
+ * Returns:
+ * 	int - the connection, or -1 if this attempt came to nothing or
+ *  eventFD is readable, and the caller should try again
+*********************************************************************/
+int OTP_acceptAny(const int listenFDs[], int listeners, int eventFD)
+{
+	int listenSocketFD = listenFDs[0];
+	if (listeners > 1 || eventFD >= 0)
+	{
+		struct pollfd ready[listeners + 1];
+		int index;
+		for (index = 0; index < listeners; index++)
+		{
+			ready[index].fd = listenFDs[index];
+			ready[index].events = POLLIN;
+		}
+		ready[listeners].fd = eventFD; // Skipped by poll if -1
+		ready[listeners].events = POLLIN;
+		if (poll(ready, listeners + 1, -1) < 0) {return -1;}
+		for (index = 0; index < listeners && !(ready[index].revents & POLLIN); index++);
+		if (index == listeners) {return -1;}
+		listenSocketFD = listenFDs[index];
+	}
+
+	int establishedConnectionFD = accept(listenSocketFD, NULL, NULL);
+	if (establishedConnectionFD < 0 && (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EMFILE || errno == ENFILE)) {return -1;}
+	if (establishedConnectionFD < 0) OTP_fatal("ERROR on accept");
+
+	int noDelay = 1; // Don't hold the small end-of-result frames back
+	setsockopt(establishedConnectionFD, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	return establishedConnectionFD;
+}
+
+/*********************************************************************
+ * static unsigned long _retryAfter(const struct OTP_Service* service, int waiting)
+ *  Guesses how long until a slot frees up: the mean request time for
+ *  each connection ahead, spread over the slots serving them
+*********************************************************************/
+static unsigned long _retryAfter(const struct OTP_Service* service, int waiting)
+{
+	unsigned long milliseconds = OTP_RETRY_MIN;
+	if (service->stats != NULL)
+	{
+		const struct OTP_Histogram* total = &service->stats->histograms[OTP_STAT_TOTAL];
+		uint64_t count = __atomic_load_n(&total->total, __ATOMIC_RELAXED);
+		uint64_t sum = __atomic_load_n(&total->sum, __ATOMIC_RELAXED);
+		int slots = service->limit > 0 ? service->limit : 1;
+		if (count > 0) {milliseconds = sum / count * (waiting + 1) / slots / 1000000;}
+	}
+	if (milliseconds < OTP_RETRY_MIN) {milliseconds = OTP_RETRY_MIN;}
+	return milliseconds < OTP_RETRY_MAX ? milliseconds : OTP_RETRY_MAX;
+}
+
+/*********************************************************************
+ * int OTP_refuseBusy(const struct OTP_Service* service, int fd, int waiting)
+ *  Turns a connection away without serving it: answers its hello with
+ *  an OTP_BUSY WELCOME saying how long to wait, then closes it. Never
+ *  blocks, so a flood of clients can't hold up the daemon; a client
+ *  whose hello comes in after the close may see the connection reset
+ *  instead, which OTP_clientHello takes as busy too.
+ * Arguments:
+ * 	const struct OTP_Service* service - what the daemon offers
+ *  int fd - the accepted connection
+ *  int waiting - connections already waiting for a slot
+ * Returns:
+ * 	int - 0, or -1 if the refusal couldn't be sent
+*********************************************************************/
+int OTP_refuseBusy(const struct OTP_Service* service, int fd, int waiting)
+{
+	char frame[OTP_FRAME_HEADER + OTP_WELCOME_SIZE];
+	OTP_statsCount(service->stats, OTP_STAT_BUSY, 1);
+
+	OTP_packHeader(frame, OTP_OP_WELCOME, 0, OTP_WELCOME_SIZE, 0);
+	OTP_packWelcome(frame + OTP_FRAME_HEADER, OTP_BUSY, _retryAfter(service, waiting));
+	ssize_t sent = send(fd, frame, sizeof(frame), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	// Follow the answer with a FIN, and take in whatever of the hello
+	// is here already, so closing doesn't reset the connection before
+	// the client reads the answer
+	char hello[OTP_FRAME_HEADER + OTP_HELLO_SIZE];
+	shutdown(fd, SHUT_WR);
+	while (recv(fd, hello, sizeof(hello), MSG_DONTWAIT) > 0);
+	close(fd);
+
+	return sent == sizeof(frame) ? 0 : -1;
+}
+
+static volatile sig_atomic_t stopPool = 0;
+static void _stopPool(int signal) { (void) signal; stopPool = 1; }
+
+/*********************************************************************
+ * static pid_t _spawnWorker(const struct sockaddr_in* address, int unixFD, const struct OTP_Service* service)
+ *  Starts a worker that listens on its own SO_REUSEPORT socket and
+ *  on the shared Unix socket, if any, and serves connections from
+ *  them until it is killed
+*********************************************************************/
+static pid_t _spawnWorker(const struct sockaddr_in* address, int unixFD, const struct OTP_Service* service)
+{
+	pid_t spawnPID = fork();
+	if (spawnPID == 0)
+	{
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		int listenFDs[2], listeners = 0;
+		if (address != NULL) {listenFDs[listeners++] = OTP_listenSocket(address, SOMAXCONN, 1);}
+		if (unixFD >= 0) {listenFDs[listeners++] = unixFD;}
+		exit(OTP_runReactor(listenFDs, listeners, service));
+	}
+	if (spawnPID < 0) {perror("SERVER: fork() failed");}
+	return spawnPID;
+}
+
+/*********************************************************************
+ * int OTP_runPrefork(const struct sockaddr_in* address, int unixFD, int workers, const struct OTP_Service* service)
+ *  Starts a pool of long-lived workers and supervises it, replacing
+ *  any worker that dies, until told to stop. No process is forked
+ *  while serving requests. The service's limit applies to each worker.
+ * Arguments:
+ * 	const struct sockaddr_in* address - the TCP address to serve on, or
+ *  	NULL for none
+ *  int unixFD - a listening Unix socket the workers share, or -1
+ *  int workers - the number of workers in the pool
+ *  const struct OTP_Service* service - what the daemon offers
+ * Returns:
+ * 	0 once SIGTERM or SIGINT has stopped the pool
+*********************************************************************/
+int OTP_runPrefork(const struct sockaddr_in* address, int unixFD, int workers, const struct OTP_Service* service)
+{
+	// Find out now, rather than in every worker, if the port is taken
+	if (address != NULL) {close(OTP_listenSocket(address, 0, 1));}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = _stopPool;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+
+	pid_t* workerPIDs = calloc(workers, sizeof(pid_t));
+	time_t* startTimes = calloc(workers, sizeof(time_t));
+	int index;
+	for (index = 0; index < workers; index++)
+	{
+		workerPIDs[index] = _spawnWorker(address, unixFD, service);
+		startTimes[index] = time(NULL);
+	}
+
+	while (!stopPool)
+	{
+		int childExitMethod = -5;
+		pid_t actualPID = waitpid(-1, &childExitMethod, 0);
+		if (actualPID < 0) {continue;}
+
+		for (index = 0; index < workers && workerPIDs[index] != actualPID; index++);
+		if (index == workers || stopPool) {continue;}
+
+		// Replace the worker, slowly if it keeps dying on startup
+		fprintf(stderr, "SERVER: worker %d exited, restarting\n", (int) actualPID);
+		if (time(NULL) - startTimes[index] < 1) {sleep(1);}
+		workerPIDs[index] = _spawnWorker(address, unixFD, service);
+		startTimes[index] = time(NULL);
+	}
+
+	// Take the pool down with the master
+	for (index = 0; index < workers; index++)
+	{
+		if (workerPIDs[index] > 0) {kill(workerPIDs[index], SIGTERM);}
+	}
+	while (wait(NULL) > 0);
+	free(workerPIDs);
+	free(startTimes);
+
+	return 0;
+}
+
+// One io_uring instance: the submission and completion rings shared
+// with the kernel, and the ring of provided buffers recv fills
+struct _Uring {
+	int fd;
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned* sqArray;
+	unsigned sqMask;
+	unsigned sqEntries;
+	unsigned sqLocalTail;	// Queued SQEs not yet published to the kernel
+	struct io_uring_sqe* sqes;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe* cqes;
+	struct io_uring_buf_ring* buffers;
+	char* bufferMemory;
+	int multishotRecv;		// Cleared if the kernel can't do multishot recv
+	const struct OTP_Service* service;
+	const int* listenFDs;
+	int listeners;
+	int open;				// Connections being served
+};
+
+// A session along with the operations it has in flight. It is freed
+// only once it is closed and the kernel has finished with all of them.
+struct _UringConnection {
+	struct OTP_Session session;
+	struct msghdr message;	// Describes the frame being sent
+	struct iovec pieces[2];
+	int pending;			// Operations the kernel still holds
+	int receiving;			// Set while a recv is armed
+	int pausing;			// Set while that recv is being cancelled
+	int sending;			// Set while a send is in flight
+	int hungUp;				// Set once the client has closed its end
+	int closed;
+};
+
+// What a completion is for, kept in the low bits of its user_data
+#define _URING_RECV 0
+#define _URING_SEND 1
+#define _URING_CANCEL 2
+#define _URING_ACCEPT 3
+#define _URING_POLL 4	// Set with _URING_ACCEPT while the listener is polled instead
+
+/*********************************************************************
+ * static int _uringEnter(struct _Uring* ring, unsigned wait)
+ *  Publishes every queued SQE to the kernel in one system call,
+ *  waiting for at least wait completions
+*********************************************************************/
+static int _uringEnter(struct _Uring* ring, unsigned wait)
+{
+	__atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+	unsigned queued = ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+	int result;
+	do {
+		result = syscall(__NR_io_uring_enter, ring->fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (result < 0 && errno == EINTR);
+	return result;
+}
+
+/*********************************************************************
+ * static struct io_uring_sqe* _uringSqe(struct _Uring* ring, int opcode, int fd, uint64_t userData)
+ *  Queues a blank SQE, flushing the queue to the kernel if it is full
+*********************************************************************/
+static struct io_uring_sqe* _uringSqe(struct _Uring* ring, int opcode, int fd, uint64_t userData)
+{
+	if (ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntries) {_uringEnter(ring, 0);}
+
+	unsigned index = ring->sqLocalTail++ & ring->sqMask;
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = userData;
+	ring->sqArray[index] = index;
+
+	return sqe;
+}
+
+/*********************************************************************
+ * static void _uringProvide(struct _Uring* ring, unsigned bufferID)
+ *  Hands a recv buffer back to the kernel for reuse
+*********************************************************************/
+static void _uringProvide(struct _Uring* ring, unsigned bufferID)
+{
+	unsigned short tail = ring->buffers->tail;
+	struct io_uring_buf* buffer = &ring->buffers->bufs[tail & (OTP_URING_BUFFERS - 1)];
+	buffer->addr = (uint64_t) (uintptr_t) (ring->bufferMemory + (size_t) bufferID * OTP_URING_BUFSIZE);
+	buffer->len = OTP_URING_BUFSIZE;
+	buffer->bid = bufferID;
+	__atomic_store_n(&ring->buffers->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*********************************************************************
+ * static int _uringRelease(struct _Uring* ring, char* rings, size_t ringSize, size_t sqeSize)
+ *  Undoes a setup that got part way, freeing whatever it had made
+ * Returns:
+ * 	-1, for _uringSetup to return
+*********************************************************************/
+static int _uringRelease(struct _Uring* ring, char* rings, size_t ringSize, size_t sqeSize)
+{
+	if (ring->bufferMemory != NULL) {free(ring->bufferMemory);}
+	if (ring->buffers != MAP_FAILED) {munmap(ring->buffers, OTP_URING_BUFFERS * sizeof(struct io_uring_buf));}
+	if (ring->sqes != MAP_FAILED) {munmap(ring->sqes, sqeSize);}
+	if (rings != MAP_FAILED) {munmap(rings, ringSize);}
+	close(ring->fd);
+
+	return -1;
+}
+
+/*********************************************************************
+ * static int _uringSetup(struct _Uring* ring)
+ *  Creates the ring, maps it, and registers the provided buffers
+ * Returns:
+ * 	0 on success, -1 if this kernel can't run the io_uring backend
+*********************************************************************/
+static int _uringSetup(struct _Uring* ring)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, OTP_URING_ENTRIES, &params);
+	if (ring->fd < 0) {return -1;}
+	ring->sqes = MAP_FAILED;
+	ring->buffers = MAP_FAILED;
+	ring->bufferMemory = NULL;
+
+	// One mapping holds both rings; the SQEs get their own
+	size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	size_t ringSize = sqSize > cqSize ? sqSize : cqSize;
+	size_t sqeSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {return _uringRelease(ring, MAP_FAILED, ringSize, sqeSize);}
+	char* rings = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->sqes = mmap(NULL, sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (rings == MAP_FAILED || ring->sqes == MAP_FAILED) {return _uringRelease(ring, rings, ringSize, sqeSize);}
+
+	ring->sqHead = (unsigned*) (rings + params.sq_off.head);
+	ring->sqTail = (unsigned*) (rings + params.sq_off.tail);
+	ring->sqArray = (unsigned*) (rings + params.sq_off.array);
+	ring->sqMask = *(unsigned*) (rings + params.sq_off.ring_mask);
+	ring->sqEntries = params.sq_entries;
+	ring->sqLocalTail = *ring->sqTail;
+	ring->cqHead = (unsigned*) (rings + params.cq_off.head);
+	ring->cqTail = (unsigned*) (rings + params.cq_off.tail);
+	ring->cqMask = *(unsigned*) (rings + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (rings + params.cq_off.cqes);
+
+	// recv picks its buffer from this ring instead of each idle
+	// connection pinning one of its own
+	ring->buffers = mmap(NULL, OTP_URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ring->bufferMemory = malloc((size_t) OTP_URING_BUFFERS * OTP_URING_BUFSIZE);
+	if (ring->buffers == MAP_FAILED || ring->bufferMemory == NULL) {return _uringRelease(ring, rings, ringSize, sqeSize);}
+
+	struct io_uring_buf_reg registration;
+	memset(&registration, 0, sizeof(registration));
+	registration.ring_addr = (uint64_t) (uintptr_t) ring->buffers;
+	registration.ring_entries = OTP_URING_BUFFERS;
+	registration.bgid = 0;
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+	{
+		return _uringRelease(ring, rings, ringSize, sqeSize);
+	}
+	unsigned bufferID;
+	for (bufferID = 0; bufferID < OTP_URING_BUFFERS; bufferID++) {_uringProvide(ring, bufferID);}
+
+	ring->multishotRecv = 1;
+	return 0;
+}
+
+/*********************************************************************
+ * static void _uringAccept(struct _Uring* ring, int listener)
+ *  Arms an accept on one of the listening sockets that keeps
+ *  delivering connections until it fails
+*********************************************************************/
+static void _uringAccept(struct _Uring* ring, int listener)
+{
+	// The listener's index rides in the user_data above the kind
+	struct io_uring_sqe* sqe = _uringSqe(ring, IORING_OP_ACCEPT, ring->listenFDs[listener], (uint64_t) listener << 3 | _URING_ACCEPT);
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+/*********************************************************************
+ * static void _uringAwait(struct _Uring* ring, int listener)
+ *  Waits for a connection on a listening socket without accepting it.
+ *  An accept takes its descriptor before looking at the backlog, so
+ *  out of descriptors one fails at once, and rearming it would spin.
+*********************************************************************/
+static void _uringAwait(struct _Uring* ring, int listener)
+{
+	struct io_uring_sqe* sqe = _uringSqe(ring, IORING_OP_POLL_ADD, ring->listenFDs[listener], (uint64_t) listener << 3 | _URING_POLL | _URING_ACCEPT);
+	sqe->poll32_events = POLLIN;
+}
+
+/*********************************************************************
+ * static void _uringRecv(struct _Uring* ring, struct _UringConnection* connection)
+ *  Arms a recv on a connection that draws from the provided buffers
+*********************************************************************/
+static void _uringRecv(struct _Uring* ring, struct _UringConnection* connection)
+{
+	struct io_uring_sqe* sqe = _uringSqe(ring, IORING_OP_RECV, connection->session.fd, (uintptr_t) connection | _URING_RECV);
+	sqe->ioprio = ring->multishotRecv ? IORING_RECV_MULTISHOT : 0;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	connection->receiving = 1;
+	connection->pending++;
+}
+
+/*********************************************************************
+ * static void _uringListen(struct _Uring* ring, struct _UringConnection* connection)
+ *  Keeps a recv armed while the connection has room for input. Input
+ *  that arrives while output is going out waits in the session, so
+ *  past OTP_URING_INPUT_MAX of it the recv is cancelled, and armed
+ *  again once the output has gone.
+*********************************************************************/
+static void _uringListen(struct _Uring* ring, struct _UringConnection* connection)
+{
+	struct OTP_Session* session = &connection->session;
+	int full = session->input.length - session->inputStart >= OTP_URING_INPUT_MAX;
+	if (connection->closed || connection->hungUp) {return;}
+
+	if (full && connection->receiving && !connection->pausing)
+	{
+		struct io_uring_sqe* sqe = _uringSqe(ring, IORING_OP_ASYNC_CANCEL, -1, (uintptr_t) connection | _URING_CANCEL);
+		sqe->addr = (uintptr_t) connection | _URING_RECV;
+		connection->pausing = 1;
+		connection->pending++;
+	}
+	else if (!full && !connection->receiving && session->state < OTP_SESSION_DONE) {_uringRecv(ring, connection);}
+}
+
+/*********************************************************************
+ * static void _uringClose(struct _Uring* ring, struct _UringConnection* connection)
+ *  Closes a connection, cancelling its recv, and frees it once the
+ *  kernel has nothing of it left in flight
+*********************************************************************/
+static void _uringClose(struct _Uring* ring, struct _UringConnection* connection)
+{
+	if (!connection->closed)
+	{
+		connection->closed = 1;
+		if (connection->receiving)
+		{
+			struct io_uring_sqe* sqe = _uringSqe(ring, IORING_OP_ASYNC_CANCEL, -1, (uintptr_t) connection | _URING_CANCEL);
+			sqe->addr = (uintptr_t) connection | _URING_RECV;
+			connection->pending++;
+		}
+		close(connection->session.fd);
+		OTP_statsConnection(ring->service->stats, 0);
+		ring->open--;
+	}
+	if (connection->pending == 0)
+	{
+		OTP_sessionFree(&connection->session);
+		free(connection);
+	}
+}
+
+/*********************************************************************
+ * static void _uringSend(struct _Uring* ring, struct _UringConnection* connection)
+ *  Sends the session's next frame, header and payload together in
+ *  one vectored send, or closes the connection once it is finished
+*********************************************************************/
+static void _uringSend(struct _Uring* ring, struct _UringConnection* connection)
+{
+	struct OTP_Session* session = &connection->session;
+	if (connection->sending || connection->closed) {return;}
+	if (session->state == OTP_SESSION_FAILED) {_uringClose(ring, connection); return;}
+
+	int count = OTP_sessionOutput(session, connection->pieces);
+	if (count > 0)
+	{
+		memset(&connection->message, 0, sizeof(connection->message));
+		connection->message.msg_iov = connection->pieces;
+		connection->message.msg_iovlen = count;
+		struct io_uring_sqe* sqe = _uringSqe(ring, IORING_OP_SENDMSG, session->fd, (uintptr_t) connection | _URING_SEND);
+		sqe->addr = (uintptr_t) &connection->message;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		connection->sending = 1;
+		connection->pending++;
+		return;
+	}
+	if (connection->hungUp && session->state < OTP_SESSION_REPLY) {OTP_sessionHangup(session);}
+	if (session->state == OTP_SESSION_DONE || session->state == OTP_SESSION_FAILED) {_uringClose(ring, connection);}
+}
+
+/*********************************************************************
+ * static void _uringCompletion(struct _Uring* ring, const struct io_uring_cqe* cqe)
+ *  Advances whichever connection a completion belongs to
+*********************************************************************/
+static void _uringCompletion(struct _Uring* ring, const struct io_uring_cqe* cqe)
+{
+	int kind = cqe->user_data & 3;
+	int more = cqe->flags & IORING_CQE_F_MORE;
+
+	if (kind == _URING_ACCEPT)
+	{
+		int listener = cqe->user_data >> 3;
+		if (cqe->user_data & _URING_POLL) {_uringAccept(ring, listener); return;}
+		if (cqe->res >= 0 && ring->service->limit > 0 && ring->open >= ring->service->limit) {OTP_refuseBusy(ring->service, cqe->res, 0);}
+		else if (cqe->res >= 0)
+		{
+			int noDelay = 1; // Don't hold the small end-of-result frames back
+			setsockopt(cqe->res, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+			ring->open++;
+
+			struct _UringConnection* connection = calloc(1, sizeof(struct _UringConnection));
+			OTP_sessionInit(&connection->session, cqe->res, ring->service, OTP_CHUNK_DEFAULT);
+			OTP_statsConnection(ring->service->stats, 1);
+			// Room for a WELCOME, a KEYREF and an ERROR up front, so
+			// queueing the last never moves one the kernel may still be
+			// sending
+			OTP_bufferReserve(&connection->session.control, 3 * OTP_FRAME_HEADER + OTP_WELCOME_SIZE + OTP_KEYREF_SIZE + OTP_ERROR_SIZE);
+			_uringRecv(ring, connection);
+		}
+		else if (cqe->res == -EMFILE || cqe->res == -ENFILE)
+		{
+			// Out of descriptors: turn the next one away, then try again
+			// only once another connection comes in
+			fprintf(stderr, "SERVER: accept: %s\n", strerror(-cqe->res));
+			_refuseSpare(ring->listenFDs[listener], ring->service);
+			if (!more) {_uringAwait(ring, listener);}
+			return;
+		}
+		if (!more) {_uringAccept(ring, listener);}
+		return;
+	}
+
+	struct _UringConnection* connection = (struct _UringConnection*) (uintptr_t) (cqe->user_data & ~(uint64_t) 3);
+	struct OTP_Session* session = &connection->session;
+	if (!more) {connection->pending--;}
+
+	// A pause's cancel leaves the connection open
+	if (kind == _URING_CANCEL)
+	{
+		if (connection->closed) {_uringClose(ring, connection);}
+		return;
+	}
+	if (kind == _URING_SEND)
+	{
+		connection->sending = 0;
+		if (cqe->res < 0) {session->state = OTP_SESSION_FAILED;}
+		else {OTP_sessionSent(session, cqe->res);}
+		if (connection->closed) {_uringClose(ring, connection); return;}
+		// Arm before sending, since a send that closes may free it
+		_uringListen(ring, connection);
+		_uringSend(ring, connection);
+		return;
+	}
+
+	// A recv: copy what arrived into the session and return the buffer
+	if (!more) {connection->receiving = connection->pausing = 0;}
+	if (cqe->flags & IORING_CQE_F_BUFFER)
+	{
+		unsigned bufferID = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		const char* data = ring->bufferMemory + (size_t) bufferID * OTP_URING_BUFSIZE;
+		size_t left = cqe->res > 0 ? cqe->res : 0;
+		while (left > 0 && !connection->closed && session->state != OTP_SESSION_FAILED)
+		{
+			size_t room;
+			char* space = OTP_sessionInputSpace(session, &room);
+			if (space == NULL) {session->state = OTP_SESSION_FAILED; break;}
+			if (room > left) {room = left;}
+			memcpy(space, data, room);
+			OTP_sessionReceived(session, room);
+			data += room;
+			left -= room;
+		}
+		_uringProvide(ring, bufferID);
+	}
+	if (connection->closed) {_uringClose(ring, connection); return;}
+
+	if (cqe->res == -EINVAL && ring->multishotRecv)
+	{
+		ring->multishotRecv = 0; // An older kernel; rearm after every recv instead
+	}
+	else if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED))
+	{
+		// The client hung up; finish any reply it is owed first
+		connection->hungUp = 1;
+		_uringSend(ring, connection);
+		return;
+	}
+	// Keep listening for the requests that follow
+	_uringListen(ring, connection);
+	_uringSend(ring, connection);
+}
+
+/*********************************************************************
+ * int OTP_runUring(const int listenFDs[], int listeners, const struct OTP_Service* service)
+ *  Serves every connection from this one process through io_uring: a
+ *  multishot accept, recv into a shared pool of provided buffers, and
+ *  vectored sends, with the operations of all connections submitted
+ *  and reaped in one system call per pass. Like the reactor, it
+ *  refuses connections past the service's limit busy.
+ * Arguments:
+ * 	const int listenFDs[] - the bound, listening sockets
+ *  int listeners - the number of listening sockets
+ *  const struct OTP_Service* service - what the daemon offers
+ * Returns:
+ * 	-1 at once if this kernel lacks what the backend needs, so the
+ *  caller can fall back to OTP_runReactor; otherwise does not return
+ *  unless io_uring fails
+*********************************************************************/
+int OTP_runUring(const int listenFDs[], int listeners, const struct OTP_Service* service)
+{
+	struct _Uring ring;
+	if (_uringSetup(&ring) < 0) {return -1;}
+	ring.service = service;
+	ring.listenFDs = listenFDs;
+	ring.listeners = listeners;
+	ring.open = 0;
+
+	signal(SIGPIPE, SIG_IGN); // A client hanging up must not take the process down
+
+	// Allow as many connections as the hard limit on descriptors does
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	_spareFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	int listener;
+	for (listener = 0; listener < listeners; listener++) {_uringAccept(&ring, listener);}
+	while (1)
+	{
+		if (_uringEnter(&ring, 1) < 0 && errno != EBUSY) OTP_fatal("ERROR entering io_uring");
+
+		// Reap everything that has completed; handlers queue new SQEs,
+		// which all go to the kernel together on the next pass
+		unsigned head = *ring.cqHead;
+		unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+		while (head != tail)
+		{
+			struct io_uring_cqe cqe = ring.cqes[head & ring.cqMask];
+			__atomic_store_n(ring.cqHead, ++head, __ATOMIC_RELEASE);
+			_uringCompletion(&ring, &cqe);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*********************************************************************
+** Program name:    OTP
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**      These are the server functions of otp_d, and of otp_enc_d and
+**      otp_dec_d built from it: a request session that does no I/O of
+**      its own, and the event loops that drive sessions over sockets.
+**      This is the header file.
+*********************************************************************/
+#ifndef OTP_SERVER_H
+#define OTP_SERVER_H
+
+#include <netinet/in.h>
+#include "otp_helpers.h"
+#include "otp_keys.h"
+#include "otp_stats.h"
+
+#define OTP_REACTOR_EVENTS 256	// Events handled per epoll_wait
+#define OTP_PREFORK_MAX 256		// Most workers in a prefork pool
+#define OTP_THREADS_MAX 1024	// Most threads in a thread pool
+#define OTP_URING_ENTRIES 1024	// Submission queue entries
+#define OTP_URING_BUFFERS 256	// Provided recv buffers, a power of 2
+#define OTP_URING_BUFSIZE (32 * 1024)	// Size of each provided buffer
+#define OTP_URING_INPUT_MAX (4 * OTP_URING_BUFSIZE)	// Input a connection holds while its output goes before it stops reading
+#define OTP_SESSION_KEEP (4 * 1024 * 1024)	// Largest buffer a reused session keeps
+#define OTP_QUEUE_DEFAULT 64	// Connections that may wait for a free slot
+
+// Session States
+#define OTP_SESSION_HELLO 0		// Waiting for the client's HELLO
+#define OTP_SESSION_TEXT 1		// Receiving plaintext or ciphertext
+#define OTP_SESSION_KEY 2		// Receiving the key
+#define OTP_SESSION_UPLOAD 3	// Receiving a key to store
+#define OTP_SESSION_REPLY 4		// Sending the rest of the result, or the error
+#define OTP_SESSION_DONE 5		// Client gone or refused; close the connection
+#define OTP_SESSION_FAILED 6	// Client broke protocol; drop the connection
+
+// What a daemon offers, shared by all of its sessions
+struct OTP_Service {
+	int serves;					// OTP_SERVE operations clients may ask for
+	struct OTP_KeyStore* keys;	// Stored keys, or NULL if the daemon keeps none
+	struct OTP_Stats* stats;	// Metrics, or NULL if none are kept
+	int limit;					// Connections served at once, 0 for the model's own limit
+	int queue;					// Connections that may wait for one to finish, -1 for OTP_QUEUE_DEFAULT
+};
+
+// One client connection, from hello through each of its requests and
+// replies in turn. A session never touches the socket itself: the
+// driver hands it received bytes and sends whatever it asks to have
+// sent, so any event loop can run it. A result goes out as the codec
+// makes it, and no more input is handled while any of it is waiting,
+// so a session holds about a frame of output, never the whole result.
+struct OTP_Session {
+	int fd;
+	int state;
+	const struct OTP_Service* service;
+	int decoding;			// The OTP_SERVE operation it asked for
+	int mode;
+	size_t chunkSize;		// Agreed in the handshake
+	size_t maxChunk;		// Largest chunk size the driver will agree to
+	struct OTP_Stream stream;
+	struct OTP_Buffer input;	// Received bytes, from inputStart on not yet parsed
+	size_t inputStart;
+	struct OTP_Buffer output;	// The codec's result, until it has been sent
+	size_t outputSent;
+	struct OTP_Buffer control;	// WELCOME and ERROR frames waiting to go out
+	size_t controlSent;
+	char header[OTP_FRAME_HEADER];	// Header of the DATA frame being sent
+	size_t headerSent;
+	size_t frameLeft;		// Payload bytes of that frame still to send
+	int replying;			// Set once the result is whole, until its END frame starts
+	const char* stored;		// Stored key still to feed the stream, or NULL
+	size_t storedLeft;		// Bytes of it still needed
+	unsigned long requestID;	// Request being received or answered
+	int inRequest;			// Set once that request's first frame is in
+	uint64_t requestStart;	// When that frame came in, 0 if not timed
+	uint64_t replyStart;	// When the request was complete
+	struct OTP_KeyUpload upload;	// Key being stored by a KEYPUT request
+};
+
+// Session Functions
+int OTP_sessionInit(struct OTP_Session* session, int fd, const struct OTP_Service* service, size_t maxChunk);
+int OTP_sessionReset(struct OTP_Session* session, int fd);
+char* OTP_sessionInputSpace(struct OTP_Session* session, size_t* room);
+int OTP_sessionReceived(struct OTP_Session* session, size_t length);
+int OTP_sessionOutput(struct OTP_Session* session, struct iovec pieces[]);
+int OTP_sessionSent(struct OTP_Session* session, size_t length);
+int OTP_sessionHangup(struct OTP_Session* session);
+int OTP_sessionFree(struct OTP_Session* session);
+int OTP_serveSession(struct OTP_Session* session);
+// Server Loops
+int OTP_listenSocket(const struct sockaddr_in* address, int backlog, int reusePort);
+int OTP_listenUnix(const char* path, int backlog);
+int OTP_acceptAny(const int listenFDs[], int listeners, int eventFD);
+int OTP_refuseBusy(const struct OTP_Service* service, int fd, int waiting);
+int OTP_runReactor(const int listenFDs[], int listeners, const struct OTP_Service* service);
+int OTP_runPrefork(const struct sockaddr_in* address, int unixFD, int workers, const struct OTP_Service* service);
+int OTP_runThreads(const int listenFDs[], int listeners, int threads, const struct OTP_Service* service);
+int OTP_runUring(const int listenFDs[], int listeners, const struct OTP_Service* service);
+
+#endif
@@ -0,0 +1,230 @@
+/*********************************************************************
+** Program name:    OTP
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**      These are the metrics functions of otp_d: counters, gauges and
+**      latency histograms kept in memory shared by every process and
+**      thread serving, and reported by the STATS opcode.
+*********************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "otp_stats.h"
+
+static const char* counterNames[OTP_STAT_COUNTERS] = {"requests", "errors", "rejected", "failed", "accepted", "bytes_in", "bytes_out", "busy"};
+static const char* gaugeNames[OTP_STAT_GAUGES] = {"connections_active", "connections_queued"};
+static const char* histogramNames[OTP_STAT_HISTOGRAMS] = {"latency_receive_us", "latency_send_us", "latency_total_us"};
+
+/*********************************************************************
+ * struct OTP_Stats* OTP_statsCreate(void)
+ *  Makes zeroed stats in shared memory, for a daemon about to fork
+ *  its workers
+ * Returns:
+ * 	struct OTP_Stats* - the stats, or NULL if they can't be mapped
+*********************************************************************/
+struct OTP_Stats* OTP_statsCreate(void)
+{
+	struct OTP_Stats* stats = mmap(NULL, sizeof(struct OTP_Stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) {return NULL;}
+	stats->started = OTP_statsNow();
+
+	return stats;
+}
+
+/*********************************************************************
+ * uint64_t OTP_statsNow(void)
+ *  Gets the time to measure latencies against
+ * Returns:
+ * 	uint64_t - monotonic nanoseconds
+*********************************************************************/
+uint64_t OTP_statsNow(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*********************************************************************
+ * void OTP_statsCount(struct OTP_Stats* stats, int counter, uint64_t amount)
+ *  Adds to a counter
+ * Arguments:
+ * 	struct OTP_Stats* stats - the stats, or NULL
+ *  int counter - the OTP_STAT counter
+ *  uint64_t amount - how much to add
+*********************************************************************/
+void OTP_statsCount(struct OTP_Stats* stats, int counter, uint64_t amount)
+{
+	if (stats == NULL) {return;}
+	__atomic_fetch_add(&stats->counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+/*********************************************************************
+ * void OTP_statsGauge(struct OTP_Stats* stats, int gauge, int64_t change)
+ *  Moves a gauge up or down
+ * Arguments:
+ * 	struct OTP_Stats* stats - the stats, or NULL
+ *  int gauge - the OTP_STAT gauge
+ *  int64_t change - how much to move it by
+*********************************************************************/
+void OTP_statsGauge(struct OTP_Stats* stats, int gauge, int64_t change)
+{
+	if (stats == NULL) {return;}
+	__atomic_fetch_add(&stats->gauges[gauge], change, __ATOMIC_RELAXED);
+}
+
+/*********************************************************************
+ * void OTP_statsConnection(struct OTP_Stats* stats, int opened)
+ *  Counts a connection being accepted or closed
+ * Arguments:
+ * 	struct OTP_Stats* stats - the stats, or NULL
+ *  int opened - 1 when the connection was accepted, 0 when closed
+*********************************************************************/
+void OTP_statsConnection(struct OTP_Stats* stats, int opened)
+{
+	if (opened) {OTP_statsCount(stats, OTP_STAT_ACCEPTED, 1);}
+	OTP_statsGauge(stats, OTP_STAT_ACTIVE, opened ? 1 : -1);
+}
+
+/*********************************************************************
+ * static size_t _bucketIndex(uint64_t value)
+ *  Finds the histogram bucket a value falls in: values below 2^SUB
+ *  get a bucket each, larger ones are placed by their top SUB + 1 bits
+*********************************************************************/
+static size_t _bucketIndex(uint64_t value)
+{
+	if (value < (1 << OTP_HIST_SUB_BITS)) {return value;}
+	int exponent = 63 - __builtin_clzll(value);
+
+	return ((size_t) (exponent - OTP_HIST_SUB_BITS + 1) << OTP_HIST_SUB_BITS) + ((value >> (exponent - OTP_HIST_SUB_BITS)) & ((1 << OTP_HIST_SUB_BITS) - 1));
+}
+
+/*********************************************************************
+ * static uint64_t _bucketTop(size_t index)
+ *  Gets the largest value that falls in a bucket
+*********************************************************************/
+static uint64_t _bucketTop(size_t index)
+{
+	if (index < (1 << OTP_HIST_SUB_BITS)) {return index;}
+	int exponent = (index >> OTP_HIST_SUB_BITS) + OTP_HIST_SUB_BITS - 1;
+	uint64_t width = (uint64_t) 1 << (exponent - OTP_HIST_SUB_BITS);
+
+	return ((uint64_t) (index & ((1 << OTP_HIST_SUB_BITS) - 1)) + (1 << OTP_HIST_SUB_BITS)) * width + width - 1;
+}
+
+/*********************************************************************
+ * void OTP_statsRecord(struct OTP_Stats* stats, int histogram, uint64_t nanoseconds)
+ *  Adds a latency to a histogram
+ * Arguments:
+ * 	struct OTP_Stats* stats - the stats, or NULL
+ *  int histogram - the OTP_STAT histogram
+ *  uint64_t nanoseconds - the latency
+*********************************************************************/
+void OTP_statsRecord(struct OTP_Stats* stats, int histogram, uint64_t nanoseconds)
+{
+	if (stats == NULL) {return;}
+	struct OTP_Histogram* counts = &stats->histograms[histogram];
+	__atomic_fetch_add(&counts->counts[_bucketIndex(nanoseconds)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counts->total, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counts->sum, nanoseconds, __ATOMIC_RELAXED);
+
+	uint64_t max = __atomic_load_n(&counts->max, __ATOMIC_RELAXED);
+	while (nanoseconds > max && !__atomic_compare_exchange_n(&counts->max, &max, nanoseconds, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*********************************************************************
+ * uint64_t OTP_histogramPercentile(const struct OTP_Histogram* histogram, double percentile)
+ *  Finds the value that percentile of the recorded values are at or
+ *  below, rounded up to the top of its bucket
+ * Arguments:
+ * 	const struct OTP_Histogram* histogram - the histogram
+ *  double percentile - from 0 to 100
+ * Returns:
+ * 	uint64_t - the value, 0 if nothing has been recorded
+*********************************************************************/
+uint64_t OTP_histogramPercentile(const struct OTP_Histogram* histogram, double percentile)
+{
+	uint64_t total = __atomic_load_n(&histogram->total, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+	if (total == 0) {return 0;}
+
+	uint64_t rank = (uint64_t) (percentile / 100.0 * total);
+	if (rank < percentile / 100.0 * total || rank == 0) {rank++;}
+
+	uint64_t seen = 0;
+	size_t index;
+	for (index = 0; index < OTP_HIST_BUCKETS; index++)
+	{
+		seen += __atomic_load_n(&histogram->counts[index], __ATOMIC_RELAXED);
+		if (seen >= rank) {return _bucketTop(index) < max ? _bucketTop(index) : max;}
+	}
+	// Values still being recorded may not be in the buckets yet
+	return max;
+}
+
+/*********************************************************************
+ * static size_t _append(char* text, size_t capacity, size_t length, const char* format, ...)
+ *  Adds a formatted line to the report, keeping it within capacity
+*********************************************************************/
+static size_t _append(char* text, size_t capacity, size_t length, const char* format, ...)
+{
+	va_list arguments;
+	if (length >= capacity) {return length;}
+	va_start(arguments, format);
+	int written = vsnprintf(text + length, capacity - length, format, arguments);
+	va_end(arguments);
+	if (written < 0) {return length;}
+
+	return length + written < capacity ? length + written : capacity - 1;
+}
+
+/*********************************************************************
+ * size_t OTP_statsFormat(struct OTP_Stats* stats, char* text, size_t capacity)
+ *  Writes the stats as "name value" lines, with rates averaged over
+ *  the daemon's uptime and latencies in microseconds
+ * Arguments:
+ * 	struct OTP_Stats* stats - the stats
+ *  char* text - where the report is stored
+ *  size_t capacity - the room in text, OTP_STATS_TEXT is plenty
+ * Returns:
+ * 	size_t - the length of the report
+*********************************************************************/
+size_t OTP_statsFormat(struct OTP_Stats* stats, char* text, size_t capacity)
+{
+	static const double percentiles[] = {50, 90, 99, 99.9};
+	static const char* percentileNames[] = {"p50", "p90", "p99", "p999"};
+	double uptime = (OTP_statsNow() - stats->started) / 1e9;
+	size_t length = 0;
+	int index, percentile;
+
+	length = _append(text, capacity, length, "uptime_seconds %.3f\n", uptime);
+	for (index = 0; index < OTP_STAT_COUNTERS; index++)
+	{
+		length = _append(text, capacity, length, "%s %llu\n", counterNames[index], (unsigned long long) __atomic_load_n(&stats->counters[index], __ATOMIC_RELAXED));
+	}
+	length = _append(text, capacity, length, "bytes_in_per_second %.0f\n", __atomic_load_n(&stats->counters[OTP_STAT_BYTES_IN], __ATOMIC_RELAXED) / uptime);
+	length = _append(text, capacity, length, "bytes_out_per_second %.0f\n", __atomic_load_n(&stats->counters[OTP_STAT_BYTES_OUT], __ATOMIC_RELAXED) / uptime);
+	for (index = 0; index < OTP_STAT_GAUGES; index++)
+	{
+		length = _append(text, capacity, length, "%s %lld\n", gaugeNames[index], (long long) __atomic_load_n(&stats->gauges[index], __ATOMIC_RELAXED));
+	}
+
+	for (index = 0; index < OTP_STAT_HISTOGRAMS; index++)
+	{
+		const struct OTP_Histogram* histogram = &stats->histograms[index];
+		uint64_t total = __atomic_load_n(&histogram->total, __ATOMIC_RELAXED);
+		uint64_t sum = __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+		length = _append(text, capacity, length, "%s count=%llu mean=%.1f", histogramNames[index], (unsigned long long) total, total > 0 ? sum / 1e3 / total : 0.0);
+		for (percentile = 0; percentile < 4; percentile++)
+		{
+			length = _append(text, capacity, length, " %s=%.1f", percentileNames[percentile], OTP_histogramPercentile(histogram, percentiles[percentile]) / 1e3);
+		}
+		length = _append(text, capacity, length, " max=%.1f\n", __atomic_load_n(&histogram->max, __ATOMIC_RELAXED) / 1e3);
+	}
+	return length;
+}
@@ -0,0 +1,73 @@
+/*********************************************************************
+** Program name:    OTP
+** Author:          Herbert Diaz <diazh@oregonstate.edu>
+** Date:            12/1/2019
+** Description:     Program 4 for CS344 Operating Systems @ OSU
+**  Program Function:
+**      These are the metrics functions of otp_d: counters, gauges and
+**      latency histograms kept in memory shared by every process and
+**      thread serving, and reported by the STATS opcode. This is the
+**      header file.
+*********************************************************************/
+#ifndef OTP_STATS_H
+#define OTP_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Counters
+#define OTP_STAT_REQUESTS 0		// Requests answered, with a result or an error
+#define OTP_STAT_ERRORS 1		// Requests answered with an ERROR frame
+#define OTP_STAT_REJECTED 2		// Connections refused at the handshake
+#define OTP_STAT_FAILED 3		// Connections dropped for breaking protocol
+#define OTP_STAT_ACCEPTED 4		// Connections accepted
+#define OTP_STAT_BYTES_IN 5		// Bytes received from clients
+#define OTP_STAT_BYTES_OUT 6	// Bytes sent to clients
+#define OTP_STAT_BUSY 7			// Connections turned away with no room to serve them
+#define OTP_STAT_COUNTERS 8
+
+// Gauges
+#define OTP_STAT_ACTIVE 0		// Connections being served
+#define OTP_STAT_QUEUED 1		// Connections accepted but waiting for a worker
+#define OTP_STAT_GAUGES 2
+
+// Latency Histograms, in nanoseconds
+#define OTP_STAT_RECEIVE 0		// A request's first frame to its last
+#define OTP_STAT_SEND 1			// Its last frame to the end of its reply
+#define OTP_STAT_TOTAL 2		// Its first frame to the end of its reply
+#define OTP_STAT_HISTOGRAMS 3
+
+// Each power of two is split into 2^OTP_HIST_SUB_BITS buckets, so a
+// recorded value is known to within 1/16th, from 1ns to 2^64ns, in a
+// fixed few KB
+#define OTP_HIST_SUB_BITS 4
+#define OTP_HIST_BUCKETS ((64 - OTP_HIST_SUB_BITS + 1) << OTP_HIST_SUB_BITS)
+#define OTP_STATS_TEXT 4096		// Room for the STATS report
+
+struct OTP_Histogram {
+	uint64_t counts[OTP_HIST_BUCKETS];
+	uint64_t total;
+	uint64_t sum;
+	uint64_t max;
+};
+
+// Lives in a shared mapping made before the daemon forks, so workers
+// and children all add to the same numbers. Every update is atomic.
+struct OTP_Stats {
+	uint64_t started;	// When the daemon started, in monotonic nanoseconds
+	uint64_t counters[OTP_STAT_COUNTERS];
+	int64_t gauges[OTP_STAT_GAUGES];
+	struct OTP_Histogram histograms[OTP_STAT_HISTOGRAMS];
+};
+
+// Stats Functions. Each update takes a NULL stats and does nothing.
+struct OTP_Stats* OTP_statsCreate(void);
+uint64_t OTP_statsNow(void);
+void OTP_statsCount(struct OTP_Stats* stats, int counter, uint64_t amount);
+void OTP_statsGauge(struct OTP_Stats* stats, int gauge, int64_t change);
+void OTP_statsConnection(struct OTP_Stats* stats, int opened);
+void OTP_statsRecord(struct OTP_Stats* stats, int histogram, uint64_t nanoseconds);
+uint64_t OTP_histogramPercentile(const struct OTP_Histogram* histogram, double percentile);
+size_t OTP_statsFormat(struct OTP_Stats* stats, char* text, size_t capacity);
+
+#endif